@@ -0,0 +1,91 @@
+#include "GUI/ImageTexture.h"
+#include <iostream>
+
+using namespace std;
+
+static int powerOfTwo(int n) {
+	int p = 1;
+	while(p < n) p <<= 1;
+	return p;
+}
+
+ImageTexture::ImageTexture() : _texture(0), _width(0), _height(0), _texWidth(0), _texHeight(0),
+	_repaints(0), _rows(0) {}
+
+void ImageTexture::reset() {
+	_texture = 0;
+	_width = _height = 0;
+}
+
+void ImageTexture::draw(Raytracer* tracer) {
+	const Framebuffer& image = tracer->getImage();
+	if(image.empty()) return;
+	int width = tracer->getWidth(), height = tracer->getHeight();
+
+	if(!_texture)
+		glGenTextures(1, &_texture);
+	glBindTexture(GL_TEXTURE_2D, _texture);
+	if(width != _width || height != _height) {
+		_width = width;
+		_height = height;
+		_texWidth = powerOfTwo(width);
+		_texHeight = powerOfTwo(height);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, _texWidth, _texHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		tracer->touchRows(0, height);
+	}
+
+	int y = 0, y0, y1;
+	while(tracer->takeDirtyRows(y, y0, y1)) {
+		// At most one row of tiles is converted to floats at a time
+		for(int b = y0; b < y1; b = (b/FB_TILE + 1)*FB_TILE) {
+			int e = min((b/FB_TILE + 1)*FB_TILE, y1);
+			_scratch.resize(width*(e-b)*4);
+			image.readRows(b, e, &_scratch[0]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, b, width, e-b, GL_RGBA, GL_FLOAT, &_scratch[0]);
+		}
+		_rows += y1-y0;
+		y = y1;
+	}
+	_repaints++;
+
+	GLint view[4];
+	glGetIntegerv(GL_VIEWPORT, view);
+	double x1 = -1 + 2.0*width/view[2], y2 = -1 + 2.0*height/view[3];
+	double s = (double)width/_texWidth, t = (double)height/_texHeight;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glDisable(GL_POLYGON_SMOOTH);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glBegin(GL_QUADS);
+	glTexCoord2d(0, 0); glVertex2d(-1, -1);
+	glTexCoord2d(s, 0); glVertex2d(x1, -1);
+	glTexCoord2d(s, t); glVertex2d(x1, y2);
+	glTexCoord2d(0, t); glVertex2d(-1, y2);
+	glEnd();
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+void ImageTexture::printStats() {
+	if(_repaints == 0 || _height == 0) return;
+	cout << "Display: " << _repaints << " repaints uploaded " << _rows << " rows, "
+		<< (double)_rows/_height << " images' worth" << endl;
+}
@@ -0,0 +1,38 @@
+#ifndef IMAGE_TEXTURE_H
+#define IMAGE_TEXTURE_H
+
+#include <FL/gl.h>
+#include "Rendering/Raytracer.h"
+#include <vector>
+
+/*
+ * Shows a ray tracer's image through a texture kept between repaints.
+ * Each repaint uploads only the rows written since the last one (see
+ * Raytracer::takeDirtyRows()) with glTexSubImage2D, instead of sending the
+ * whole image again; the rows are converted from the tracer's framebuffer
+ * format to floats on the way, one row of tiles at a time. The texture is
+ * sized to powers of two, which OpenGL 1.1 needs, and the image sits in its
+ * lower-left corner, drawn 1:1 from the lower-left corner of the viewport
+ * like glDrawPixels does.
+ */
+class ImageTexture {
+protected:
+	GLuint _texture;
+	int _width, _height; // image in the texture
+	int _texWidth, _texHeight;
+	long long _repaints, _rows;
+	std::vector<float> _scratch; // row of tiles being uploaded
+
+public:
+	ImageTexture();
+
+	// Uploads the changed rows and draws the image; needs the window's context
+	void draw(Raytracer* tracer);
+	// Forgets the texture after its GL context went away
+	void reset();
+
+	void clearStats() { _repaints = _rows = 0; }
+	void printStats();
+};
+
+#endif
@@ -1,5 +1,10 @@
 #include "GUI/MainWindow.h"
 #include "GUI/PropertyWindow.h"
+#include "Rendering/Wavefront.h"
+#include "Rendering/Antialias.h"
+#include "Rendering/Denoiser.h"
+#include "Rendering/Upsampler.h"
+#include "Rendering/Relighter.h"
 #include <time.h>
 #include <iostream>
 #include <sstream>
@@ -55,8 +60,11 @@ int MainWindow::_inputMode = INPUT_VIEWING;
 Geometry* MainWindow::_highlighted = NULL;
 
 RaytraceViewer* MainWindow::_rtviewer = NULL;
+LiveRenderer* MainWindow::_live = NULL;
+bool MainWindow::_liveView = false;
+bool MainWindow::_liveReported = false;
+ImageTexture MainWindow::_liveImage;
 MainWindow* MainWindow::_singleton = NULL;
-bool MainWindow::_tracing = false; // true while tracing
 
 const int WIN_LOWER_SPACE = 0;
 const int MENU_SPACE = 0;
@@ -70,6 +78,9 @@ void MainWindow::updateModelView() {
 		Mat4* rot = _scene->getRotate();
 		(*mv) = (*trans)*(*rot);
 	}
+	// A render of the old view is replaced by one of the new view
+	if(_rtviewer && _rtviewer->isRendering())
+		startTracing();
 }
 
 // the arcball code has its own matrix class
@@ -112,6 +123,59 @@ void mReadMatrix(GLdouble m[16], Mat4& mat) {
 	for(int i = 0; i < 16; i++) mat[i>>2][i&3] = m[i];
 }
 
+// Traces the scene from the current view in the background
+void MainWindow::startTracing() {
+	if(!_scene) return;
+	GLdouble mv[16], proj[16];
+	GLint viewport[4] = {0, 0, _rtviewer->w(), _rtviewer->h()};
+
+	mLoadMatrix(*_scene->getModelview(), mv);
+	mLoadMatrix(_proj, proj);
+	_rtviewer->trace(mv, proj, viewport);
+}
+
+// Called before the tracer's settings change, which the render in progress can't see halfway
+void MainWindow::stopTracing() {
+	if(_rtviewer)
+		_rtviewer->cancel();
+}
+
+// Renders trace a snapshot of the scene, so the object and material being
+// edited may be copies from now on; everything pointing at the old ones follows
+Geometry* MainWindow::editGeometry(Geometry* geom) {
+	Geometry* copy = _scene->editObject(geom);
+	if(copy == geom) return geom;
+
+	if(_geom2op.count(geom)) {
+		Operator* op = _geom2op[geom];
+		_geom2op.erase(geom);
+		op->setPrimaryOp(dynamic_cast<Operand*>(copy));
+		_geom2op[copy] = op;
+	}
+
+	if(_zbuffer->getSelected() == geom)
+		_zbuffer->setSelected(copy);
+	if(_highlighted == geom) {
+		_highlighted = copy;
+		_zbuffer->setHightlighted(copy);
+	}
+	PropertyWindow::replaceGeometry(geom, copy);
+	return copy;
+}
+
+Material* MainWindow::editMaterial(Material* mat) {
+	return _scene->editMaterial(mat);
+}
+
+void MainWindow::traceProgress(double fraction, void* data) {
+	ostringstream label;
+	if(fraction < 1)
+		label << "Raytracer (" << (int)(fraction*100) << "%)";
+	else
+		label << "Raytracer";
+	_rtviewer->copy_label(label.str().c_str());
+}
+
 MainWindow::MainWindow(int x, int y, int w, int h, const char* l) : Fl_Window(x, y, w, h+MENU_SPACE+WIN_LOWER_SPACE, l) {
 	show();
 	resize(x, y, w, h);
@@ -149,6 +213,8 @@ MainWindow::MainWindow(int x, int y, int w, int h, const char* l) : Fl_Window(x,
 	else
 		// Using a smaller window to trace out a smaller picture can be much faster. Good for testing purpose.
 		_rtviewer = new RaytraceViewer(100, 100, w/2, h/2, "Raytracer");
+	_rtviewer->setProgressCallback(traceProgress, NULL);
+	_live = new LiveRenderer();
 
 	this->callback(escapeButtonCb, this);
 	Fl::repeat_timeout(REFRESH_RATE, MainWindow::updateCb, this);
@@ -162,6 +228,7 @@ MainWindow::MainWindow(int x, int y, int w, int h, const char* l) : Fl_Window(x,
 }
 
 void MainWindow::exitMenuCb(Fl_Widget* widget, void* win) {
+	stopTracing();
 	exit(0);
 }
 
@@ -200,15 +267,17 @@ void MainWindow::prepScene() {
 		_zbuffer->setScene(_scene);
 		_zbuffer->initScene();
 
-		_rtviewer->getRaytracer()->setScene(_scene);
 		updateModelView();
 	}
 }
 
 void MainWindow::openFile(const string& fname) {
+	stopTracing();
+	_live->stop();
 	if (_scene)
 		delete _scene;
 	_scene = SceneUtils::readScene(fname);
+	_rtviewer->setScene(_scene);
 	prepScene();
 }
 
@@ -218,9 +287,12 @@ void MainWindow::saveFile(const string& fname) {
 
 // this is the main display function, calls the zbuffer renderer
 void MainWindow::display() {
-	if(_tracing) return; // No drawing while ray-tracing
-
-	if(_scene) {
+	if(_scene && _liveView) {
+		glClear(GL_DEPTH_BUFFER_BIT|GL_COLOR_BUFFER_BIT);
+		drawLive();
+		glutSwapBuffers();
+	}
+	else if(_scene) {
 		glClear(GL_DEPTH_BUFFER_BIT|GL_COLOR_BUFFER_BIT);
 		glEnable(GL_LIGHTING);
 		glEnable(GL_DEPTH_TEST);
@@ -245,6 +317,25 @@ void MainWindow::display() {
 	}
 }
 
+// Ray-traced view of the current camera in place of the preview, see LiveRenderer
+void MainWindow::drawLive() {
+	GLdouble mv[16], proj[16];
+	GLint viewport[4] = {0, 0, _w, _h};
+
+	mLoadMatrix(*_scene->getModelview(), mv);
+	mLoadMatrix(_proj, proj);
+	if(_live->update(_scene, mv, proj, viewport))
+		_liveReported = false;
+
+	if(_live->hasFrame())
+		_liveImage.draw(_live->getRaytracer());
+
+	if(!_liveReported && _live->isComplete()) {
+		_live->printStats();
+		_liveReported = true;
+	}
+}
+
 MainWindow::~MainWindow() {}
 
 void MainWindow::resize(int x0, int y0, int w, int h) {
@@ -381,6 +472,7 @@ Pt3 MainWindow::getMousePoint(int mx, int my) {
 
 // This handles the case when an operator translation is performed
 void MainWindow::handleAxisTrans(int mx, int my, bool beginTrans) {
+	editGeometry(_zbuffer->getSelected());
 	Operator* op = _zbuffer->getOperator();
 	Ray r = getMouseRay(mx, my);
 	Pt3 np;
@@ -403,6 +495,7 @@ void MainWindow::handleAxisTrans(int mx, int my, bool beginTrans) {
 
 // This handles the case when an operator rotation occurs
 void MainWindow::handleAxisRot(int mx, int my, bool beginRot) {
+	editGeometry(_zbuffer->getSelected());
 	Operator* op = _zbuffer->getOperator();
 	Ray r = getMouseRay(mx, my);
 	Pt3 center = op->getPrimaryOp()->getCenter();
@@ -439,8 +532,6 @@ void MainWindow::handleAxisRot(int mx, int my, bool beginRot) {
 
 // The mouse move event
 void MainWindow::mouseMove(int x, int y) {
-	if(_tracing) return; // Stop any interaction while ray-tracing
-
 	if(_inputMode == INPUT_VIEWING) {
 		if(_buttonSt == GLUT_DOWN) {
 			if(_button == GLUT_LEFT_BUTTON) {
@@ -520,8 +611,6 @@ void MainWindow::mouseMove(int x, int y) {
 
 // mouse event (button presses)
 void MainWindow::mouseEvent(int button, int state, int x, int y) {
-	if(_tracing) return; // Stop any interaction while ray-tracing
-
 	double w = (double) getWidth();
 	double h = (double) getHeight();
 
@@ -617,8 +706,6 @@ void MainWindow::mouseEvent(int button, int state, int x, int y) {
 // idle is a function that gets repeatedly called.  Here we test for various keyboard modifiers such as control or shift to
 // determine the state of the session (for example whether we are editing a shape or moving the camera, etc).
 void MainWindow::idle() {
-	if(_tracing) return; // Stop any interaction while ray-tracing
-
 	// here is where we hack holding down control
 	bool pCtrl = _holdCtrl;
 	_holdCtrl = (glutGetModifiers() & GLUT_ACTIVE_CTRL) != 0;
@@ -661,15 +748,13 @@ void MainWindow::idle() {
 }
 
 void MainWindow::specialKey(int key, int x, int y ) {
+	// Settings only change between renders
+	if(key != GLUT_KEY_F5 && key != GLUT_KEY_F3)
+		stopTracing();
+
 	// press F5 to bring up the ray trace window
 	if(key == GLUT_KEY_F5) {
 		if(_scene) {
-			GLdouble mv[16], proj[16];
-			GLint viewport[4] = {0, 0, _rtviewer->w(), _rtviewer->h()};
-
-			mLoadMatrix(*_scene->getModelview(), mv);
-			mLoadMatrix(_proj, proj);
-
 			// Hack: fix the white border bug for show()
 			int rtw = _rtviewer->w();
 			int rth = _rtviewer->h();
@@ -681,17 +766,98 @@ void MainWindow::specialKey(int key, int x, int y ) {
 			_rtviewer->show();
 			_rtviewer->resize(rtx, rty, rtw, rth);
 
-			_tracing = true;
-			_rtviewer->trace(mv, proj, viewport);
-			_tracing = false;
+			startTracing();
 		}
 	}
+	// press F3 to switch the viewport between the preview and a live ray-traced view
+	else if(key == GLUT_KEY_F3) {
+		_liveView = !_liveView;
+		if(!_liveView)
+			_live->stop();
+		cout << (_liveView ? "Live ray-traced view" : "Preview") << endl;
+	}
 	else if(key == GLUT_KEY_F4) {
 		_rtviewer->hide();
 	}
+	// press F2 to cycle the pixel format of the ray trace window's image
+	else if(key == GLUT_KEY_F2) {
+		Raytracer* tracer = _rtviewer->getRaytracer();
+		tracer->setFormat((tracer->getFormat() + 1) % FB_NUM_FORMATS);
+		cout << "Framebuffer: " << Framebuffer::formatName(tracer->getFormat()) << ", "
+			<< Framebuffer::pixelSize(tracer->getFormat()) << " bytes per pixel" << endl;
+	}
+	// press F1 to toggle shading recorded hits again after material and light edits
+	else if(key == GLUT_KEY_F1) {
+		Relighter* relighter = _rtviewer->getRaytracer()->getRelighter();
+		relighter->setEnabled(!relighter->getEnabled());
+		cout << "Relighting: " << (relighter->getEnabled() ? "on" : "off") << endl;
+	}
+	// press F6 to switch between recursive and wavefront ray tracing
+	else if(key == GLUT_KEY_F6) {
+		Raytracer* tracer = _rtviewer->getRaytracer();
+		if(tracer->getMode() == RT_MODE_WAVEFRONT) {
+			tracer->setMode(RT_MODE_RECURSIVE);
+			cout << "Tracing mode: recursive" << endl;
+		}
+		else {
+			tracer->setMode(RT_MODE_WAVEFRONT);
+			cout << "Tracing mode: wavefront" << endl;
+		}
+	}
+	// press F7 to toggle sorting of secondary rays in wavefront mode
+	else if(key == GLUT_KEY_F7) {
+		WavefrontRenderer* wavefront = _rtviewer->getRaytracer()->getWavefront();
+		wavefront->setSortSecondary(!wavefront->getSortSecondary());
+		cout << "Secondary ray sorting: " << (wavefront->getSortSecondary() ? "on" : "off") << endl;
+	}
+	// press F8 to toggle rasterized primary visibility
+	else if(key == GLUT_KEY_F8) {
+		Raytracer* tracer = _rtviewer->getRaytracer();
+		tracer->setRasterPrimary(!tracer->getRasterPrimary());
+		cout << "Rasterized primary visibility: " << (tracer->getRasterPrimary() ? "on" : "off") << endl;
+	}
+	// press F9 to cycle through full, progressive and time-limited progressive rendering
+	else if(key == GLUT_KEY_F9) {
+		Raytracer* tracer = _rtviewer->getRaytracer();
+		if(!tracer->getProgressive()) {
+			tracer->setProgressive(true);
+			_rtviewer->setTimeBudget(0);
+			cout << "Progressive rendering: on" << endl;
+		}
+		else if(_rtviewer->getTimeBudget() == 0) {
+			_rtviewer->setTimeBudget(0.5);
+			cout << "Progressive rendering: on, " << _rtviewer->getTimeBudget() << "s budget" << endl;
+		}
+		else {
+			tracer->setProgressive(false);
+			_rtviewer->setTimeBudget(0);
+			cout << "Progressive rendering: off" << endl;
+		}
+	}
+	// press F10 to cycle the depth of adaptive anti-aliasing
+	else if(key == GLUT_KEY_F10) {
+		Antialiaser* aa = _rtviewer->getRaytracer()->getAntialiaser();
+		aa->setMaxDepth(aa->getMaxDepth() >= 3 ? 0 : aa->getMaxDepth() + 1);
+		cout << "Anti-aliasing depth: " << aa->getMaxDepth() << endl;
+	}
+	// press F11 to toggle denoising of the finished image
+	else if(key == GLUT_KEY_F11) {
+		Denoiser* denoiser = _rtviewer->getRaytracer()->getDenoiser();
+		denoiser->setIterations(denoiser->getIterations() > 0 ? 0 : 3);
+		cout << "Denoising: " << (denoiser->getIterations() > 0 ? "on" : "off") << endl;
+	}
+	// press F12 to cycle between full, half and quarter resolution shading
+	else if(key == GLUT_KEY_F12) {
+		Upsampler* upsampler = _rtviewer->getRaytracer()->getUpsampler();
+		upsampler->setReduction(upsampler->getReduction() >= RT_MAX_REDUCTION ? 1 : upsampler->getReduction()*2);
+		cout << "Shading resolution: 1/" << upsampler->getReduction() << endl;
+	}
 }
 
-void MainWindow::escapeButtonCb(Fl_Widget* widget, void* win) { exit(0); }
+void MainWindow::escapeButtonCb(Fl_Widget* widget, void* win) {
+	stopTracing();
+	exit(0);
+}
 void MainWindow::mouseEntered(int state) {}
 
 void MainWindow::normalKey(unsigned char key, int x, int y) {
@@ -20,6 +20,8 @@
 #include "Rendering/Operator.h"
 
 #include "GUI/RaytraceViewer.h"
+#include "Rendering/LiveRenderer.h"
+#include "GUI/ImageTexture.h"
 
 #include "Common/Matrix.h"
 
@@ -70,7 +72,12 @@ protected:
 	static MainWindow* _singleton;
 
 	static RaytraceViewer* _rtviewer;
-	static bool _tracing;
+
+	// Live mode shows _live's ray-traced image in place of the preview
+	static LiveRenderer* _live;
+	static bool _liveView;
+	static bool _liveReported; // statistics printed for the current frame
+	static ImageTexture _liveImage;
 
 	Fl_Menu_Bar* _menuBar;
 
@@ -79,12 +86,17 @@ public:
 	~MainWindow();
 
 	static Scene* getScene() { return _scene; }
+	static void stopTracing();
+	// Editable versions of a scene object and a material, see Scene::editObject()
+	static Geometry* editGeometry(Geometry* geom);
+	static Material* editMaterial(Material* mat);
 
 protected:
 	static inline int getWidth() { return _w; }
 	static inline int getHeight() { return _h; }
 
 	static void display();
+	static void drawLive();
 
 	static void mouseMove(int x, int y);
 	static void mouseEvent (int button, int state, int x, int y);
@@ -96,6 +108,8 @@ protected:
 	static void idle();
 
 	static void updateModelView();
+	static void startTracing();
+	static void traceProgress(double fraction, void* data);
 	static void handleZoom(int x, int y, bool b);
 	static void handleRot(int x, int y, bool b);
 	static void handleAxisTrans(int x, int y, bool b);
@@ -1,4 +1,5 @@
 #include "GUI/PropertyWindow.h"
+#include "GUI/MainWindow.h"
 #include <FL/Fl_Color_Chooser.h>
 #include <FL/Fl_Menu_Bar.H>
 #include "Common/Common.h"
@@ -93,6 +94,7 @@ void MaterialWindow::colorButton(Fl_Widget* widget, void* p) {
 	double b = color[2];
 
 	if(fl_color_chooser("Choose Color", r, g, b)) {
+		win->_mat = MainWindow::editMaterial(win->_mat);
 		color = Color(r, g, b);
 		button->setColor(color);
 
@@ -111,6 +113,7 @@ void MaterialWindow::valueChanged(Fl_Widget* widget, void* p) {
 	Fl_Float_Input* input = (Fl_Float_Input*) widget;
 
 	double nv = atof(input->value());
+	win->_mat = MainWindow::editMaterial(win->_mat);
 	if(input == win->_specExp)
 		win->_mat->setSpecExponent(nv);
 	else if(input == win->_refl)
@@ -312,8 +315,14 @@ void PropertyWindow::closePropertyWindow() {
 	}
 }
 
+void PropertyWindow::replaceGeometry(Geometry* geom, Geometry* copy) {
+	if(_singleton && _singleton->getGeometry() == geom)
+		_singleton->setGeometry(copy);
+}
+
 void PropertyWindow::handleAllCb(Fl_Widget* widget, void* w) {
 	PropertyWindow* win = (PropertyWindow*) w;
+	MainWindow::editGeometry(win->getGeometry());
 	win->getGeometry()->accept(win->getGeometryUpdater(), NULL);
 }
 
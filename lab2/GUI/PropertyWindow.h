@@ -77,6 +77,8 @@ public:
 	PropertyWindow();
 	static void openPropertyWindow(Geometry* geom, Operator* op, Material* mat);
 	static void closePropertyWindow();
+	// Points the window at the copy that replaced the geometry in the scene
+	static void replaceGeometry(Geometry* geom, Geometry* copy);
 
 	Fl_Counter* getRadius() { return _radius; }
 
@@ -1,83 +1,165 @@
 #include "GUI/RaytraceViewer.h"
+#include "Rendering/Wavefront.h"
+#include "Rendering/Antialias.h"
+#include "Rendering/Denoiser.h"
+#include "Rendering/Upsampler.h"
+#include "Rendering/ImageWriter.h"
+#include "Rendering/HdrWriter.h"
 
 #include <FL/gl.h>
 #include <GL/glu.h>
-#include <time.h>
 #include <FL/Fl_File_Chooser.H>
 
-extern "C" {
-#include "Common/bmpfile.h"
-}
-
 GLUquadric* gQuadric = NULL;
 
 RaytraceViewer::RaytraceViewer(int x, int y, int w, int h, const char* l)
-: Fl_Gl_Window(x, y, w, h, l) {
+: Fl_Gl_Window(x, y, w, h, l), _cancel(false), _finished(false), _steps(0) {
 	_tracer = new Raytracer();
+	// Re-traces only what an edit changed when the scene is traced again. The
+	// relighter stays off until F1 turns it on: its per-pixel records take
+	// far more memory than the dependency masks.
+	_tracer->setIncremental(true);
+	_timeBudget = 0;
+	_scene = NULL;
+	_snapshot = NULL;
+	_rendering = false;
+	_progressCb = NULL;
+	_progressData = NULL;
 }
 
 RaytraceViewer::~RaytraceViewer() {
+	setScene(NULL);
 	delete _tracer;
 }
 
+void RaytraceViewer::setScene(Scene* scene) {
+	cancel();
+	if(_snapshot)
+		Scene::release(_snapshot);
+	_snapshot = NULL;
+	_scene = scene;
+	_tracer->setScene(NULL);
+}
+
 void RaytraceViewer::trace(GLdouble modelview[16], GLdouble proj[16], GLint view[4]) {
+	if(!_scene) return;
+	cancel();
+	if(_snapshot)
+		Scene::release(_snapshot);
+	_snapshot = _scene->snapshot();
+	_tracer->setScene(_snapshot);
 	_tracer->drawInit(modelview, proj, view);
-	make_current();
-
-	// How many pixels to calculate between each in-progress drawing
-	int stepSize = 30000;
 
 	cout << "Ray tracing..." << endl;
-	clock_t begin = clock();
+	_image.clearStats();
+	_begin = chrono::steady_clock::now();
+	_cancel = false;
+	_finished = false;
+	_steps = 0;
+	_rendering = true;
+	_worker = thread(&RaytraceViewer::work, this);
+	Fl::add_timeout(RT_REPAINT_INTERVAL, repaintCb, this);
+}
+
+void RaytraceViewer::work() {
+	while(!_cancel) {
+		if(_tracer->draw(RT_WORKER_STEP))
+			break;
+		_steps++;
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - _begin).count();
+		if(_tracer->getProgressive() && _timeBudget > 0 && seconds >= _timeBudget) {
+			cout << "Time budget reached after " << _tracer->getProgressLevel() << " of "
+				<< RT_PROGRESSIVE_LEVELS << " levels" << endl;
+			break;
+		}
+	}
+	_finished = true;
+}
 
-	// Drawing in progress, showing partial results
-	while(!_tracer->draw(stepSize))
-		draw();
+void RaytraceViewer::cancel() {
+	if(!_rendering) return;
+	Fl::remove_timeout(repaintCb, this);
+	if(_finished) {
+		finish();
+		return;
+	}
+	_cancel = true;
+	_worker.join();
+	_rendering = false;
+	// Only part of the image matches the recorded scene state
+	_tracer->discardRecords();
+	cout << "Rendering cancelled" << endl;
+	redraw();
+}
+
+void RaytraceViewer::repaintCb(void* p) {
+	RaytraceViewer* viewer = (RaytraceViewer*) p;
+	viewer->redraw();
+	if(viewer->_finished) {
+		viewer->finish();
+		return;
+	}
 
-	// Final drawing
-	draw();
+	// Steps beyond the pixel count are anti-aliasing and later passes
+	if(viewer->_progressCb) {
+		double pixels = (double)viewer->_tracer->getWidth() * viewer->_tracer->getHeight();
+		double fraction = pixels > 0 ? viewer->_steps * RT_WORKER_STEP / pixels : 0;
+		viewer->_progressCb(fraction < 0.99 ? fraction : 0.99, viewer->_progressData);
+	}
+	Fl::repeat_timeout(RT_REPAINT_INTERVAL, repaintCb, p);
+}
 
-	clock_t end = clock();
-	cout << "Rendering time: " << (end-begin)/(1.*CLOCKS_PER_SEC) << "s" << endl;
+void RaytraceViewer::finish() {
+	_worker.join();
+	_rendering = false;
+	if(_progressCb)
+		_progressCb(1.0, _progressData);
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - _begin).count();
+	cout << "Rendering time: " << seconds << "s" << endl;
+	if(_tracer->getMode() == RT_MODE_WAVEFRONT)
+		_tracer->getWavefront()->getStats().print();
+	_tracer->printShadowStats();
+	_tracer->printPrimaryStats();
+	_tracer->getUpsampler()->printStats();
+	_tracer->getAntialiaser()->printStats();
+	_tracer->getDenoiser()->printStats();
+	_tracer->printIncrementalStats();
+	_image.printStats();
 }
 
 void RaytraceViewer::draw() {
+	if(!context_valid())
+		_image.reset();
 	if(!valid())
 		init();
 
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-	float* pixels = _tracer->getPixels();
-	glRasterPos2f(-1., -1.);
-	if(pixels)
-		glDrawPixels(_tracer->getWidth(), _tracer->getHeight(), GL_RGBA, GL_FLOAT, pixels);
+	_image.draw(_tracer);
 	swap_buffers();
 }
 
 int RaytraceViewer::handle(int ev) {
 	if(ev == FL_KEYUP) {
 		if(Fl::event_key() == 's' && Fl::event_ctrl()) {
-			char* newfile = fl_file_chooser("Save Image", ".bmp (*.bmp)", "./images/", 0);
+			// The worker writes the image and buffers until it finishes
+			if(_rendering && !_finished) {
+				cout << "Still rendering, save once the image is done" << endl;
+				return 1;
+			}
+			// Joins a worker that has finished but not been collected yet
+			cancel();
+
+			// Shift also saves the depth, normal and object buffers into float images
+			bool aovs = Fl::event_shift() != 0;
+			char* newfile = fl_file_chooser("Save Image", "Images (*.{bmp,png,ppm,pfm,exr})", "./images/", 0);
 			if(newfile == NULL) return 0;
 
-			int h = _tracer->getHeight();
-			int w = _tracer->getWidth();
-			float* pixels = _tracer->getPixels();
-
-			bmpfile_t* bfile = bmp_create(w, h, 32);
-			for(int j = 0; j < h; j++) {
-				for(int i = 0; i < w; i++) {
-					int offset = (j*w+i) * 4;
-					rgb_pixel_t pix = {
-						(unsigned char)(pixels[offset+2]*255),
-						(unsigned char)(pixels[offset+1]*255),
-						(unsigned char)(pixels[offset]*255),
-						(unsigned char)(pixels[offset+3]*255)
-					};
-					bmp_set_pixel(bfile, i, (h-1)-j, pix);
-				}
-			}
-			bmp_save(bfile, newfile);
-			bmp_destroy(bfile);
+			if(ImageWriter::formatOf(newfile) < 0 && HdrWriter::formatOf(newfile) < 0)
+				cout << "Images are saved as .bmp, .png, .ppm, .pfm or .exr" << endl;
+			else if(!_tracer->saveImage(newfile, false, aovs))
+				cout << "Could not save " << newfile << endl;
 			return 1;
 		}
 	}
@@ -6,16 +6,62 @@
 #include "FL/Fl.H"
 
 #include "Rendering/Raytracer.h"
+#include "GUI/ImageTexture.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Seconds between repaints of a render in progress
+#define RT_REPAINT_INTERVAL 0.05
+// Pixels the worker traces between checks for cancellation
+#define RT_WORKER_STEP 256
+
+// Called on the UI thread while rendering, with the rough fraction done
+typedef void (*RenderProgressCb)(double fraction, void* data);
+
+/*
+ * Renders run on a worker thread, so the application stays responsive.
+ * drawInit() runs on the UI thread before the worker starts, because it
+ * reallocates the image the viewer repaints from. The worker then calls
+ * Raytracer::draw() in small steps and checks for cancellation between
+ * them; a timer on the UI thread repaints every RT_REPAINT_INTERVAL,
+ * uploading only the rows finished since the last repaint, reports progress
+ * and prints the statistics once the worker is done. Each render traces a snapshot of the
+ * scene (see Scene::snapshot()), kept until the next one starts, so the scene
+ * can be edited while the worker runs.
+ */
 class RaytraceViewer : public Fl_Gl_Window {
 protected:
 	Raytracer* _tracer;
+	double _timeBudget; // seconds, 0 renders to completion
+	Scene* _scene;
+	Scene* _snapshot; // version of _scene the tracer renders
+	ImageTexture _image;
+
+	std::thread _worker;
+	std::atomic<bool> _cancel;
+	std::atomic<bool> _finished;
+	std::atomic<long long> _steps;
+	bool _rendering;
+	std::chrono::steady_clock::time_point _begin;
+	RenderProgressCb _progressCb;
+	void* _progressData;
+
+	void work();
+	void finish();
+	static void repaintCb(void* viewer);
 
 public:
 	RaytraceViewer(int x, int y, int w, int h, const char* l = 0);
 	~RaytraceViewer();
 
+	// Starts rendering in the background, cancelling a render in progress
 	void trace(GLdouble modelview[16], GLdouble proj[16], GLint view[4]);
+	// Stops the render in progress and waits for the worker, keeping what it drew
+	void cancel();
+	bool isRendering() { return _rendering; }
+	void setProgressCallback(RenderProgressCb cb, void* data) { _progressCb = cb; _progressData = data; }
 
 	void draw();
 	int handle(int flag);
@@ -23,6 +69,11 @@ public:
 	void resize(int x, int y, int width, int height);
 
 	Raytracer* getRaytracer() { return _tracer; }
+	// Scene traced from now on; cancels the render in progress
+	void setScene(Scene* scene);
+	// Stops progressive renders after the given time, keeping the levels done so far
+	void setTimeBudget(double seconds) { _timeBudget = seconds; }
+	double getTimeBudget() { return _timeBudget; }
 };
 
 
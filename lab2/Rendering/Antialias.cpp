@@ -0,0 +1,141 @@
+#include "Rendering/Antialias.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+void Antialiaser::begin() {
+	_width = _tracer->getWidth();
+	_height = _tracer->getHeight();
+	_last = 0;
+	_samples = (long long)_width*_height;
+	if(_maxDepth == 0) return;
+	_taken.clear();
+	_takenRow = 0;
+
+	// The base image covers the lower-left corner of every pixel; the corners
+	// along the right and top edges still have to be traced
+	_corners.resize((_width+1)*(_height+1));
+	for(int y = 0; y <= _height; y++) {
+		for(int x = 0; x <= _width; x++) {
+			PixelSample& s = _corners[x + y*(_width+1)];
+			if(x < _width && y < _height) {
+				Color c = _tracer->getPixel(x, y);
+				s.color = Color(c[0], c[1], c[2]);
+				s.object = _tracer->getPrimaryObject(x, y);
+			}
+			else
+				s = sample(x, y);
+		}
+	}
+}
+
+bool Antialiaser::draw(int step) {
+	if(_maxDepth == 0) return true;
+
+	int size = _width*_height;
+	int j;
+	for(j = _last; j < size && j < _last+step; j++) {
+		int x = j % _width, y = j / _width;
+		int w = _width+1;
+		if(y != _takenRow) {
+			// Samples below this pixel row are never asked for again
+			long long scale = 1 << RT_AA_MAX_DEPTH;
+			long long first = y*scale*(w*scale);
+			for(unordered_map<long long, PixelSample>::iterator it = _taken.begin(); it != _taken.end(); )
+				it = it->first < first ? _taken.erase(it) : ++it;
+			_takenRow = y;
+		}
+		Color color = subdivide(x, y, 1, _corners[x + y*w], _corners[x+1 + y*w],
+			_corners[x + (y+1)*w], _corners[x+1 + (y+1)*w], 0);
+		color[3] = 1;
+		_tracer->setPixel(x, y, color);
+	}
+
+	_last = j;
+	return (_last >= size);
+}
+
+PixelSample Antialiaser::sample(double x, double y) {
+	PixelSample s;
+	Ray ray = _tracer->primaryRay(x, y);
+	HitRecord hit;
+	// Tile lists carry a pixel of slack, so the pixel below and left of the sample will do
+	int px = min((int)x, _width-1), py = min((int)y, _height-1);
+	if(_tracer->intersect(ray, hit, _tracer->primaryCandidates(px, py)))
+		s.color = _tracer->shade(ray, hit, 0, 1.0).color;
+	else
+		s.color = Color(0, 0, 0);
+	s.object = hit.object;
+	_samples++;
+	return s;
+}
+
+// Samples on square edges, which the neighbouring square may have traced already
+PixelSample Antialiaser::sharedSample(double x, double y) {
+	long long scale = 1 << RT_AA_MAX_DEPTH;
+	long long key = (long long)(y*scale)*((_width+1)*scale) + (long long)(x*scale);
+	unordered_map<long long, PixelSample>::iterator it = _taken.find(key);
+	if(it != _taken.end())
+		return it->second;
+	PixelSample s = sample(x, y);
+	_taken[key] = s;
+	return s;
+}
+
+bool Antialiaser::differs(const PixelSample& a, const PixelSample& b, const PixelSample& c, const PixelSample& d) {
+	if(a.object != b.object || a.object != c.object || a.object != d.object)
+		return true;
+
+	const PixelSample* s[4] = { &a, &b, &c, &d };
+	for(int i = 0; i < 3; i++) {
+		double lo = s[0]->color[i], hi = lo;
+		for(int k = 1; k < 4; k++) {
+			lo = min(lo, s[k]->color[i]);
+			hi = max(hi, s[k]->color[i]);
+		}
+		if(hi - lo > _threshold) return true;
+	}
+	return false;
+}
+
+// c00 is the corner at (x, y), c10 at (x+size, y), c01 at (x, y+size) and c11 opposite to c00
+Color Antialiaser::subdivide(double x, double y, double size, const PixelSample& c00, const PixelSample& c10,
+	const PixelSample& c01, const PixelSample& c11, int depth) {
+	if(depth >= _maxDepth || !differs(c00, c10, c01, c11)) {
+		Color avg;
+		for(int i = 0; i < 3; i++)
+			avg[i] = (c00.color[i] + c10.color[i] + c01.color[i] + c11.color[i]) / 4;
+		return avg;
+	}
+
+	double h = size/2;
+	PixelSample bottom = sharedSample(x+h, y);
+	PixelSample left = sharedSample(x, y+h);
+	PixelSample mid = sample(x+h, y+h);
+	PixelSample right = sharedSample(x+size, y+h);
+	PixelSample top = sharedSample(x+h, y+size);
+
+	Color q[4] = {
+		subdivide(x, y, h, c00, bottom, left, mid, depth+1),
+		subdivide(x+h, y, h, bottom, c10, mid, right, depth+1),
+		subdivide(x, y+h, h, left, mid, c01, top, depth+1),
+		subdivide(x+h, y+h, h, mid, right, top, c11, depth+1)
+	};
+	Color avg;
+	for(int i = 0; i < 3; i++)
+		avg[i] = (q[0][i] + q[1][i] + q[2][i] + q[3][i]) / 4;
+	return avg;
+}
+
+double Antialiaser::samplesPerPixel() {
+	if(_width*_height == 0) return 0;
+	return (double)_samples / ((double)_width*_height);
+}
+
+void Antialiaser::printStats() {
+	if(_maxDepth == 0) return;
+	cout << "Anti-aliasing: " << samplesPerPixel() << " samples per pixel (depth " << _maxDepth
+		<< ", threshold " << _threshold << ")" << endl;
+}
@@ -0,0 +1,67 @@
+#ifndef ANTIALIAS_H
+#define ANTIALIAS_H
+
+#include "Rendering/Raytracer.h"
+#include <unordered_map>
+#include <vector>
+
+// Deepest subdivision of a pixel, 4^depth squares
+#define RT_AA_MAX_DEPTH 4
+
+// A primary sample: its color and the object it hit (-1 for the background)
+struct PixelSample {
+	Color color;
+	int object;
+};
+
+/*
+ * Adaptive anti-aliasing after Whitted. The base image already holds one
+ * sample per pixel corner, so every pixel is the square between four of
+ * them. Squares whose corners hit different objects or differ in color by
+ * more than the threshold are split into four, tracing the new corners, up
+ * to the maximum depth; a pixel's color is the average over its squares.
+ * Neighbouring squares share the samples on their common edges, which are
+ * traced once and looked up after that.
+ */
+class Antialiaser {
+protected:
+	Raytracer* _tracer;
+	int _maxDepth; // 0 turns anti-aliasing off
+	double _threshold;
+
+	int _width;
+	int _height;
+	std::vector<PixelSample> _corners; // (width+1) x (height+1) base samples
+	int _last;
+	long long _samples; // traced, each position counted once
+
+	// Subdivision samples by their position on the grid of the deepest
+	// squares; only rows from the current pixel row up are kept
+	std::unordered_map<long long, PixelSample> _taken;
+	int _takenRow;
+
+	PixelSample sample(double x, double y);
+	PixelSample sharedSample(double x, double y);
+	bool differs(const PixelSample& a, const PixelSample& b, const PixelSample& c, const PixelSample& d);
+	Color subdivide(double x, double y, double size, const PixelSample& c00, const PixelSample& c10,
+		const PixelSample& c01, const PixelSample& c11, int depth);
+
+public:
+	Antialiaser(Raytracer* tracer) : _tracer(tracer), _maxDepth(0), _threshold(0.1),
+		_width(0), _height(0), _last(0), _samples(0), _takenRow(0) {}
+
+	// Starts a pass over the finished base image of the tracer
+	void begin();
+	// Refines up to step pixels, returns true when the image is done
+	bool draw(int step);
+
+	void setMaxDepth(int depth) { _maxDepth = depth < 0 ? 0 : (depth > RT_AA_MAX_DEPTH ? RT_AA_MAX_DEPTH : depth); }
+	int getMaxDepth() { return _maxDepth; }
+	void setThreshold(double t) { _threshold = t; }
+	double getThreshold() { return _threshold; }
+
+	double samplesPerPixel();
+	void printStats();
+};
+
+#endif
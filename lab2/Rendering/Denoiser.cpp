@@ -0,0 +1,135 @@
+#include "Rendering/Denoiser.h"
+#include "Rendering/Raytracer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// B3-spline taps
+static const float kernel[5] = { 1.f/16, 1.f/4, 3.f/8, 1.f/4, 1.f/16 };
+
+void Denoiser::apply() {
+	_seconds = 0;
+	if(_iterations == 0 || _tracer->getImage().empty()) return;
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	_width = _tracer->getWidth();
+	_height = _tracer->getHeight();
+	int size = _width*_height;
+
+	const float* normals = _tracer->getPrimaryNormals();
+	const float* depths = _tracer->getPrimaryDepths();
+	for(int c = 0; c < 3; c++) {
+		_color[0][c].resize(size);
+		_color[1][c].resize(size);
+		_normal[c].resize(size);
+	}
+	_depth.resize(size);
+	_object.resize(size);
+	for(int k = 0; k < size; k++) {
+		Color color = _tracer->getPixel(k % _width, k / _width);
+		for(int c = 0; c < 3; c++) {
+			_color[0][c][k] = (float)color[c];
+			_normal[c][k] = normals[k*3 + c];
+		}
+		_depth[k] = depths[k];
+		_object[k] = (float)_tracer->getPrimaryObject(k % _width, k / _width);
+	}
+
+	int numThreads = max(1, (int)thread::hardware_concurrency());
+	numThreads = min(numThreads, _height);
+	int src = 0;
+	for(int pass = 0; pass < _iterations; pass++) {
+		vector<thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(thread(&Denoiser::filterRows, this, pass, src, _height*t/numThreads, _height*(t+1)/numThreads));
+		filterRows(pass, src, 0, _height/numThreads);
+		for(size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+		src = 1 - src;
+	}
+
+	for(int k = 0; k < size; k++) {
+		int x = k % _width, y = k / _width;
+		Color color = _tracer->getPixel(x, y);
+		for(int c = 0; c < 3; c++)
+			color[c] = _color[src][c][k];
+		_tracer->setPixel(x, y, color);
+	}
+
+	_seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+/*
+ * Writes rows [y0, y1) of the other color buffer. Each of the 25 taps is
+ * applied to the whole row at once over the span where it stays inside
+ * the image, accumulating into per-row sums.
+ */
+void Denoiser::filterRows(int pass, int src, int y0, int y1) {
+	const int w = _width;
+	const int step = 1 << pass;
+	const float invColor = (float)(1 << (2*pass)) / (float)(_sigmaColor*_sigmaColor);
+	const float invNormal = 1.f / (float)(_sigmaNormal*_sigmaNormal);
+	const float invDepth = 1.f / (float)(_sigmaDepth*_sigmaDepth);
+
+	const float* r = _color[src][0].data();
+	const float* g = _color[src][1].data();
+	const float* b = _color[src][2].data();
+	const float* nx = _normal[0].data();
+	const float* ny = _normal[1].data();
+	const float* nz = _normal[2].data();
+	const float* z = _depth.data();
+	const float* id = _object.data();
+
+	vector<float> sumR(w), sumG(w), sumB(w), sumW(w);
+	for(int y = y0; y < y1; y++) {
+		fill(sumR.begin(), sumR.end(), 0.f);
+		fill(sumG.begin(), sumG.end(), 0.f);
+		fill(sumB.begin(), sumB.end(), 0.f);
+		fill(sumW.begin(), sumW.end(), 0.f);
+
+		const int row = y*w;
+		for(int ty = -2; ty <= 2; ty++) {
+			int yy = y + ty*step;
+			if(yy < 0 || yy >= _height) continue;
+
+			for(int tx = -2; tx <= 2; tx++) {
+				const int off = (yy - y)*w + tx*step;
+				const int xs = max(0, -tx*step), xe = min(w, w - tx*step);
+				const float h = kernel[ty+2] * kernel[tx+2];
+
+				for(int x = xs; x < xe; x++) {
+					const int p = row + x, q = p + off;
+					float dr = r[q] - r[p], dg = g[q] - g[p], db = b[q] - b[p];
+					float dnx = nx[q] - nx[p], dny = ny[q] - ny[p], dnz = nz[q] - nz[p];
+					float dz = (z[q] - z[p]) / ((z[p] + 1e-3f) * step);
+					float e = (dr*dr + dg*dg + db*db)*invColor + (dnx*dnx + dny*dny + dnz*dnz)*invNormal + dz*dz*invDepth;
+					float wgt = h * expf(-e) * (float)(id[q] == id[p]);
+					sumR[x] += wgt*r[q];
+					sumG[x] += wgt*g[q];
+					sumB[x] += wgt*b[q];
+					sumW[x] += wgt;
+				}
+			}
+		}
+
+		// The center tap always has weight h > 0, so sumW can't be 0
+		float* outR = _color[1-src][0].data() + row;
+		float* outG = _color[1-src][1].data() + row;
+		float* outB = _color[1-src][2].data() + row;
+		for(int x = 0; x < w; x++) {
+			float inv = 1.f / sumW[x];
+			outR[x] = sumR[x]*inv;
+			outG[x] = sumG[x]*inv;
+			outB[x] = sumB[x]*inv;
+		}
+	}
+}
+
+void Denoiser::printStats() {
+	if(_iterations == 0) return;
+	cout << "Denoising: " << _iterations << " passes in " << _seconds << "s" << endl;
+}
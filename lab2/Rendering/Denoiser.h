@@ -0,0 +1,58 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <vector>
+
+class Raytracer;
+
+// Most filter passes; pass i reaches 2^(i+1) pixels out
+#define RT_DENOISE_MAX_ITERATIONS 6
+
+/*
+ * Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) for images
+ * traced with few samples. Every pass blurs with a 5x5 B3-spline kernel
+ * whose taps are spread 2^i pixels apart, so a few passes cover a wide
+ * area at 25 taps per pixel each. Taps are weighted down by the difference
+ * in color, normal and depth to the center pixel and dropped when they show
+ * another object, so edges and silhouettes stay sharp. The color tolerance
+ * halves with every pass.
+ *
+ * The guide buffers are the tracer's primary normals, depths and object IDs.
+ * All buffers are kept as separate float planes and every tap runs over a
+ * contiguous span of a row, which keeps the inner loop free of branches;
+ * rows are split between threads.
+ */
+class Denoiser {
+protected:
+	Raytracer* _tracer;
+	int _iterations; // 0 turns the filter off
+	double _sigmaColor, _sigmaNormal, _sigmaDepth;
+
+	int _width;
+	int _height;
+	std::vector<float> _color[2][3]; // ping-pong color planes
+	std::vector<float> _normal[3];
+	std::vector<float> _depth;
+	std::vector<float> _object;
+	double _seconds;
+
+	void filterRows(int pass, int src, int y0, int y1);
+
+public:
+	Denoiser(Raytracer* tracer) : _tracer(tracer), _iterations(0),
+		_sigmaColor(0.6), _sigmaNormal(0.3), _sigmaDepth(0.05),
+		_width(0), _height(0), _seconds(0) {}
+
+	// Filters the tracer's finished image in place
+	void apply();
+
+	void setIterations(int n) { _iterations = n < 0 ? 0 : (n > RT_DENOISE_MAX_ITERATIONS ? RT_DENOISE_MAX_ITERATIONS : n); }
+	int getIterations() { return _iterations; }
+	void setSigmaColor(double s) { _sigmaColor = s; }
+	void setSigmaNormal(double s) { _sigmaNormal = s; }
+	void setSigmaDepth(double s) { _sigmaDepth = s; }
+
+	void printStats();
+};
+
+#endif
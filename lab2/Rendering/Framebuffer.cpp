@@ -0,0 +1,258 @@
+#include "Rendering/Framebuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+static const char* formatNames[FB_NUM_FORMATS] = { "RGBA float", "RGB float", "RGB half", "RGBA8 sRGB" };
+static const char* shortNames[FB_NUM_FORMATS] = { "rgba32f", "rgb32f", "rgb16f", "srgb8" };
+
+// Rounds to the nearest half, ties to even; too large values become infinite
+static unsigned short floatToHalf(float f) {
+	uint32_t u;
+	memcpy(&u, &f, 4);
+	uint32_t sign = (u >> 16) & 0x8000;
+	int exp = (int)((u >> 23) & 0xff);
+	uint32_t mant = u & 0x7fffff;
+	if(exp == 0xff)
+		return (unsigned short)(sign | 0x7c00 | (mant ? 0x200 : 0));
+	exp += 15 - 127;
+	if(exp >= 31)
+		return (unsigned short)(sign | 0x7c00);
+	if(exp <= 0) {
+		// Subnormal half
+		if(exp < -10) return (unsigned short)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		uint32_t rest = mant & ((1u << shift) - 1), tie = 1u << (shift-1);
+		if(rest > tie || (rest == tie && (h & 1))) h++;
+		return (unsigned short)(sign | h);
+	}
+	// A carry out of the mantissa correctly bumps the exponent
+	uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+	uint32_t rest = mant & 0x1fff;
+	if(rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+	return (unsigned short)(sign | h);
+}
+
+static float halfToFloat(unsigned short h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+	uint32_t u;
+	if(exp == 0) {
+		if(mant == 0)
+			u = sign;
+		else {
+			exp = 127 - 15 + 1;
+			while(!(mant & 0x400)) {
+				mant <<= 1;
+				exp--;
+			}
+			u = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+	}
+	else if(exp == 31)
+		u = sign | 0x7f800000 | (mant << 13);
+	else
+		u = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+	float f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+
+static unsigned char encodeSRGB(double c) {
+	if(!(c > 0)) return 0;
+	if(c >= 1) return 255;
+	c = c <= 0.0031308 ? 12.92*c : 1.055*pow(c, 1/2.4) - 0.055;
+	return (unsigned char)(c*255 + 0.5);
+}
+
+static unsigned char encodeLinear(double c) {
+	if(!(c > 0)) return 0;
+	if(c >= 1) return 255;
+	return (unsigned char)(c*255 + 0.5);
+}
+
+// Linear values of the 256 sRGB codes
+static const float* srgbTable() {
+	static float table[256];
+	static bool filled = false;
+	if(!filled) {
+		for(int k = 0; k < 256; k++) {
+			double c = k/255.0;
+			table[k] = (float)(c <= 0.04045 ? c/12.92 : pow((c + 0.055)/1.055, 2.4));
+		}
+		filled = true;
+	}
+	return table;
+}
+// Filled before main() so that tracing threads never race to fill it
+static const float* srgbDecode = srgbTable();
+
+int Framebuffer::pixelSize(int format) {
+	switch(format) {
+	case FB_RGB_FLOAT: return 12;
+	case FB_RGB_HALF: return 6;
+	case FB_RGBA8_SRGB: return 4;
+	default: return 16;
+	}
+}
+
+const char* Framebuffer::formatName(int format) {
+	return format >= 0 && format < FB_NUM_FORMATS ? formatNames[format] : "unknown";
+}
+
+const char* Framebuffer::shortName(int format) {
+	return format >= 0 && format < FB_NUM_FORMATS ? shortNames[format] : "unknown";
+}
+
+int Framebuffer::parseFormat(const string& name) {
+	for(int k = 0; k < FB_NUM_FORMATS; k++)
+		if(name == shortNames[k])
+			return k;
+	return -1;
+}
+
+void Framebuffer::resize(int width, int height, int format) {
+	if(width == _width && height == _height && format == _format && !_data.empty())
+		return;
+	_width = width;
+	_height = height;
+	_format = format;
+	_pixelSize = pixelSize(format);
+	_tilesX = (width + FB_TILE-1) / FB_TILE;
+	int tilesY = (height + FB_TILE-1) / FB_TILE;
+
+	vector<unsigned char>().swap(_data);
+	_data.assign((size_t)_tilesX*tilesY*FB_TILE*FB_TILE*_pixelSize + (FB_ALIGN-1), 0);
+	_base = (FB_ALIGN - (size_t)((uintptr_t)_data.data() % FB_ALIGN)) % FB_ALIGN;
+}
+
+void Framebuffer::set(int x, int y, const Color& color) {
+	unsigned char* p = pixel(x, y);
+	switch(_format) {
+	case FB_RGBA_FLOAT: {
+		float* f = (float*)p;
+		for(int i = 0; i < 4; i++)
+			f[i] = (float)color[i];
+		break;
+	}
+	case FB_RGB_FLOAT: {
+		float* f = (float*)p;
+		for(int i = 0; i < 3; i++)
+			f[i] = (float)color[i];
+		break;
+	}
+	case FB_RGB_HALF: {
+		unsigned short* h = (unsigned short*)p;
+		for(int i = 0; i < 3; i++)
+			h[i] = floatToHalf((float)color[i]);
+		break;
+	}
+	case FB_RGBA8_SRGB:
+		for(int i = 0; i < 3; i++)
+			p[i] = encodeSRGB(color[i]);
+		p[3] = encodeLinear(color[3]);
+		break;
+	}
+}
+
+Color Framebuffer::get(int x, int y) const {
+	const unsigned char* p = pixel(x, y);
+	Color color;
+	switch(_format) {
+	case FB_RGBA_FLOAT: {
+		const float* f = (const float*)p;
+		for(int i = 0; i < 4; i++)
+			color[i] = f[i];
+		break;
+	}
+	case FB_RGB_FLOAT: {
+		const float* f = (const float*)p;
+		for(int i = 0; i < 3; i++)
+			color[i] = f[i];
+		color[3] = 1;
+		break;
+	}
+	case FB_RGB_HALF: {
+		const unsigned short* h = (const unsigned short*)p;
+		for(int i = 0; i < 3; i++)
+			color[i] = halfToFloat(h[i]);
+		color[3] = 1;
+		break;
+	}
+	case FB_RGBA8_SRGB:
+		for(int i = 0; i < 3; i++)
+			color[i] = srgbDecode[p[i]];
+		color[3] = p[3] / 255.0;
+		break;
+	}
+	return color;
+}
+
+/*
+ * Walks each row through the tiles it crosses; the part of the row in a
+ * tile is contiguous, so every run of up to FB_TILE pixels converts in a
+ * tight loop with the format decided once per run, and is a plain copy
+ * when the format already matches.
+ */
+void Framebuffer::readRows(int y0, int y1, float* out, int channels) const {
+	y0 = max(y0, 0);
+	y1 = min(y1, _height);
+	bool alpha = channels == 4;
+	for(int y = y0; y < y1; y++) {
+		float* row = out + (size_t)(y - y0)*_width*channels;
+		for(int x0 = 0; x0 < _width; x0 += FB_TILE) {
+			int n = min(FB_TILE, _width - x0);
+			const unsigned char* src = pixel(x0, y);
+			float* dst = row + x0*channels;
+			if(_pixelSize == channels*4 && _format != FB_RGBA8_SRGB) {
+				memcpy(dst, src, n*channels*4);
+				continue;
+			}
+			switch(_format) {
+			case FB_RGBA_FLOAT: {
+				const float* f = (const float*)src;
+				for(int i = 0; i < n; i++) {
+					dst[i*channels] = f[i*4];
+					dst[i*channels+1] = f[i*4+1];
+					dst[i*channels+2] = f[i*4+2];
+				}
+				break;
+			}
+			case FB_RGB_FLOAT: {
+				const float* f = (const float*)src;
+				for(int i = 0; i < n; i++) {
+					dst[i*channels] = f[i*3];
+					dst[i*channels+1] = f[i*3+1];
+					dst[i*channels+2] = f[i*3+2];
+					if(alpha) dst[i*4+3] = 1.f;
+				}
+				break;
+			}
+			case FB_RGB_HALF: {
+				const unsigned short* h = (const unsigned short*)src;
+				for(int i = 0; i < n; i++) {
+					dst[i*channels] = halfToFloat(h[i*3]);
+					dst[i*channels+1] = halfToFloat(h[i*3+1]);
+					dst[i*channels+2] = halfToFloat(h[i*3+2]);
+					if(alpha) dst[i*4+3] = 1.f;
+				}
+				break;
+			}
+			case FB_RGBA8_SRGB:
+				for(int i = 0; i < n; i++) {
+					dst[i*channels] = srgbDecode[src[i*4]];
+					dst[i*channels+1] = srgbDecode[src[i*4+1]];
+					dst[i*channels+2] = srgbDecode[src[i*4+2]];
+					if(alpha) dst[i*4+3] = src[i*4+3] / 255.f;
+				}
+				break;
+			}
+		}
+	}
+}
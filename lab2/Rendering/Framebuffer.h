@@ -0,0 +1,84 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "Common/Matrix.h"
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Pixel formats, from the most precise to the most compact
+#define FB_RGBA_FLOAT 0 // 16 bytes per pixel, the default
+#define FB_RGB_FLOAT 1  // 12 bytes, alpha reads as 1
+#define FB_RGB_HALF 2   // 6 bytes, 16-bit floats
+#define FB_RGBA8_SRGB 3 // 4 bytes, 8 bits per channel, color sRGB encoded
+#define FB_NUM_FORMATS 4
+
+// Edge of the square tiles the pixels are stored in
+#define FB_TILE 8
+// Tiles start on a cache line
+#define FB_ALIGN 64
+
+/*
+ * Image a Raytracer draws into. Pixels are stored tile by tile, each
+ * FB_TILE x FB_TILE tile contiguous and aligned to a cache line. Threads
+ * that write different tiles, like the LiveRenderer's bands of FB_TILE
+ * rows, never share a cache line, while neighbouring scanlines of the
+ * compact formats would share them. Tiles along the right and top edges
+ * are padded to full size.
+ *
+ * Colors go in and come out as linear values; the compact formats trade
+ * precision for memory and bandwidth. readRows() turns rows back into the
+ * scanline RGBA floats that display and output take; callers convert a
+ * row or a row of tiles at a time rather than the whole image.
+ */
+class Framebuffer {
+protected:
+	int _width;
+	int _height;
+	int _format;
+	int _tilesX;
+	int _pixelSize; // bytes
+	std::vector<unsigned char> _data;
+	size_t _base; // offset of the first tile in _data
+
+	unsigned char* pixel(int x, int y) {
+		return &_data[_base + (((y/FB_TILE)*_tilesX + x/FB_TILE)*FB_TILE*FB_TILE + (y%FB_TILE)*FB_TILE + x%FB_TILE) * _pixelSize];
+	}
+	const unsigned char* pixel(int x, int y) const {
+		return &_data[_base + (((y/FB_TILE)*_tilesX + x/FB_TILE)*FB_TILE*FB_TILE + (y%FB_TILE)*FB_TILE + x%FB_TILE) * _pixelSize];
+	}
+
+	// The tiles point into _data
+	Framebuffer(const Framebuffer&);
+	Framebuffer& operator=(const Framebuffer&);
+
+public:
+	Framebuffer() : _width(0), _height(0), _format(FB_RGBA_FLOAT), _tilesX(0), _pixelSize(16), _base(0) {}
+
+	// Keeps the image when nothing changes, otherwise the new one is black
+	void resize(int width, int height, int format);
+
+	void set(int x, int y, const Color& color);
+	Color get(int x, int y) const;
+	// Rows [y0, y1) as RGBA floats in scanline order, width*4 floats per row;
+	// RGB floats with 3 channels
+	void readRows(int y0, int y1, float* out, int channels = 4) const;
+	// Pixels from (x, y) to the right edge of their tile, as stored
+	const unsigned char* run(int x, int y) const { return pixel(x, y); }
+	int getPixelSize() const { return _pixelSize; }
+
+	bool empty() const { return _width == 0 || _height == 0; }
+	int getWidth() const { return _width; }
+	int getHeight() const { return _height; }
+	int getFormat() const { return _format; }
+	// Bytes taken by the tiles, padding included
+	size_t getBytes() const { return _data.empty() ? 0 : _data.size() - (FB_ALIGN-1); }
+
+	static int pixelSize(int format);
+	static const char* formatName(int format);
+	static const char* shortName(int format);
+	// Format by its short name (rgba32f, rgb32f, rgb16f, srgb8), -1 if unknown
+	static int parseFormat(const std::string& name);
+};
+
+#endif
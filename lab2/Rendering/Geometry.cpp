@@ -54,3 +54,45 @@ double GeometryUtils::planeRayDeg(const Plane& pl, const Vec3& xa, const Ray& r)
 	double rr = atan2(py, px);
 	return (rr < 0) ? (rr+2*M_PI) : rr;
 }
+
+BoundingBox::BoundingBox() : min(DINF, DINF, DINF), max(-DINF, -DINF, -DINF) {}
+
+void BoundingBox::extend(const Pt3& p) {
+	for(int i = 0; i < 3; i++) {
+		if(p[i] < min[i]) min[i] = p[i];
+		if(p[i] > max[i]) max[i] = p[i];
+	}
+}
+
+void BoundingBox::extend(const BoundingBox& b) {
+	if(b.empty()) return;
+	extend(b.min);
+	extend(b.max);
+}
+
+void BoundingBox::pad(double d) {
+	for(int i = 0; i < 3; i++) {
+		min[i] -= d;
+		max[i] += d;
+	}
+}
+
+bool BoundingBox::contains(const Pt3& p) const {
+	for(int i = 0; i < 3; i++)
+		if(p[i] < min[i] || p[i] > max[i]) return false;
+	return true;
+}
+
+bool BoundingBox::overlaps(const BoundingBox& b) const {
+	for(int i = 0; i < 3; i++)
+		if(b.max[i] < min[i] || b.min[i] > max[i]) return false;
+	return true;
+}
+
+Pt3 BoundingBox::center() const {
+	return Pt3((min[0]+max[0])/2, (min[1]+max[1])/2, (min[2]+max[2])/2);
+}
+
+double BoundingBox::radius() const {
+	return mag(max-min)/2;
+}
@@ -33,6 +33,27 @@ public:
 	}
 };
 
+// Axis-aligned bounding box, used to cull objects before exact intersection tests
+class BoundingBox {
+public:
+	Pt3 min;
+	Pt3 max;
+
+	BoundingBox();
+	BoundingBox(const Pt3& lo, const Pt3& hi) : min(lo), max(hi) {}
+
+	bool empty() const { return min[0] > max[0]; }
+	void extend(const Pt3& p);
+	void extend(const BoundingBox& b);
+	void pad(double d);
+
+	bool contains(const Pt3& p) const;
+	bool overlaps(const BoundingBox& b) const;
+
+	Pt3 center() const;
+	double radius() const; // radius of the bounding sphere around center()
+};
+
 class Sphere;
 class Ellipsoid;
 class Box;
@@ -72,6 +93,9 @@ public:
 		}
 	}
 
+	// A copy of the shape, see Scene::editObject()
+	virtual Geometry* clone() const = 0;
+
 	virtual void accept(GeometryVisitor* visitor, void* ret) = 0;
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) {}
 };
@@ -0,0 +1,329 @@
+#include "Rendering/HdrWriter.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+// EXR channel pixel types
+#define EXR_HALF 1
+#define EXR_FLOAT 2
+// Shortest run worth a run code and longest run one code holds, as in OpenEXR
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN 127
+
+// Both formats are little-endian, like every machine this builds for, so
+// floats and offsets are written in memory order
+
+static void putLE(unsigned char* p, uint64_t v, int bytes) {
+	for(int k = 0; k < bytes; k++)
+		p[k] = (unsigned char)(v >> (8*k));
+}
+
+static void putInt(vector<unsigned char>& out, int v) {
+	unsigned char p[4];
+	putLE(p, (uint32_t)v, 4);
+	out.insert(out.end(), p, p+4);
+}
+
+static void putFloat(vector<unsigned char>& out, float v) {
+	unsigned char p[4];
+	memcpy(p, &v, 4);
+	out.insert(out.end(), p, p+4);
+}
+
+static void putString(vector<unsigned char>& out, const char* s) {
+	out.insert(out.end(), s, s + strlen(s) + 1);
+}
+
+// Name, type and size of an attribute, its value follows
+static void putAttribute(vector<unsigned char>& out, const char* name, const char* type, int size) {
+	putString(out, name);
+	putString(out, type);
+	putInt(out, size);
+}
+
+static void putChannel(vector<unsigned char>& out, const char* name, int type) {
+	putString(out, name);
+	putInt(out, type);
+	unsigned char linear[4] = { 0 }; // pLinear and 3 reserved bytes
+	out.insert(out.end(), linear, linear+4);
+	putInt(out, 1); // x sampling
+	putInt(out, 1); // y sampling
+}
+
+// Stores count values of size bytes, spaced stride values apart in src, one after another in dst
+static void putPlane(unsigned char* dst, const void* src, int size, int stride, int count) {
+	const unsigned char* s = (const unsigned char*)src;
+	for(int x = 0; x < count; x++)
+		memcpy(dst + x*size, s + (size_t)x*stride*size, size);
+}
+
+int HdrWriter::formatOf(const string& fname) {
+	size_t dot = fname.rfind('.');
+	if(dot == string::npos) return -1;
+	string ext = fname.substr(dot+1);
+	for(size_t k = 0; k < ext.size(); k++)
+		ext[k] = (char)tolower(ext[k]);
+	if(ext == "pfm") return HDR_PFM;
+	if(ext == "exr") return HDR_EXR;
+	return -1;
+}
+
+HdrWriter::HdrWriter(const Framebuffer& image, const HdrAovs& aovs, bool rle) : _file(NULL), _image(&image),
+	_aovs(aovs), _width(image.getWidth()), _height(image.getHeight()), _rle(rle) {
+	_half = image.getFormat() == FB_RGB_HALF;
+	_alpha = image.getFormat() == FB_RGBA_FLOAT || image.getFormat() == FB_RGBA8_SRGB;
+}
+
+HdrWriter::~HdrWriter() {
+	if(_file) fclose(_file);
+}
+
+bool HdrWriter::save(const string& fname, const Framebuffer& image, const HdrAovs& aovs, bool rle) {
+	int format = formatOf(fname);
+	if(format < 0 || image.empty()) return false;
+	HdrWriter writer(image, aovs, rle);
+	return format == HDR_PFM ? writer.writePFM(fname) : writer.writeEXR(fname);
+}
+
+/*
+ * PFM rows go from the bottom up, the order of the framebuffer's rows, and
+ * a negative scale marks little-endian floats.
+ */
+bool HdrWriter::writePFM(const string& fname) {
+	_file = fopen(fname.c_str(), "wb");
+	if(!_file) return false;
+	bool ok = fprintf(_file, "PF\n%d %d\n-1.0\n", _width, _height) > 0;
+	_row.resize(_width*3);
+	for(int y = 0; y < _height; y++) {
+		_image->readRows(y, y+1, &_row[0], 3);
+		ok = fwrite(&_row[0], 4, _row.size(), _file) == _row.size() && ok;
+	}
+	ok = fclose(_file) == 0 && ok;
+	_file = NULL;
+
+	string base = fname.substr(0, fname.rfind('.'));
+	if(_aovs.depths)
+		ok = writePlane(base + ".depth.pfm", _aovs.depths, 1) && ok;
+	if(_aovs.normals)
+		ok = writePlane(base + ".normal.pfm", _aovs.normals, 3) && ok;
+	if(_aovs.ids)
+		ok = writeIds(base + ".id.pfm") && ok;
+	return ok;
+}
+
+// The AOV buffers are laid out like a PFM file already and are written at once
+bool HdrWriter::writePlane(const string& fname, const float* data, int channels) {
+	_file = fopen(fname.c_str(), "wb");
+	if(!_file) return false;
+	size_t count = (size_t)_width*_height*channels;
+	bool ok = fprintf(_file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", _width, _height) > 0;
+	ok = fwrite(data, 4, count, _file) == count && ok;
+	ok = fclose(_file) == 0 && ok;
+	_file = NULL;
+	return ok;
+}
+
+bool HdrWriter::writeIds(const string& fname) {
+	_file = fopen(fname.c_str(), "wb");
+	if(!_file) return false;
+	bool ok = fprintf(_file, "Pf\n%d %d\n-1.0\n", _width, _height) > 0;
+	_row.resize(_width);
+	for(int y = 0; y < _height; y++) {
+		const int* ids = _aovs.ids + (size_t)y*_width;
+		for(int x = 0; x < _width; x++)
+			_row[x] = (float)ids[x];
+		ok = fwrite(&_row[0], 4, _width, _file) == (size_t)_width && ok;
+	}
+	ok = fclose(_file) == 0 && ok;
+	_file = NULL;
+	return ok;
+}
+
+/*
+ * A single-part scanline file with one row per chunk, top row first:
+ * the header, a table with the file offset of every chunk, then the chunks.
+ * Their sizes are only known once compressed, so the table is written
+ * with zeros and filled in at the end.
+ */
+bool HdrWriter::writeEXR(const string& fname) {
+	_file = fopen(fname.c_str(), "wb");
+	if(!_file) return false;
+	bool ok = writeHeader();
+	long table = ftell(_file);
+	vector<uint64_t> offsets(_height, 0);
+	ok = fwrite(&offsets[0], 8, _height, _file) == (size_t)_height && ok;
+
+	uint64_t pos = (uint64_t)table + 8*(uint64_t)_height;
+	_line.resize(lineSize());
+	for(int k = 0; k < _height && ok; k++) {
+		fillLine(_height-1 - k);
+		const vector<unsigned char>& data = _rle ? compressLine() : _line;
+		unsigned char head[8];
+		putLE(head, k, 4);
+		putLE(head+4, data.size(), 4);
+		ok = fwrite(head, 1, 8, _file) == 8 && fwrite(&data[0], 1, data.size(), _file) == data.size();
+		offsets[k] = pos;
+		pos += 8 + data.size();
+	}
+
+	ok = ok && fseek(_file, table, SEEK_SET) == 0
+		&& fwrite(&offsets[0], 8, _height, _file) == (size_t)_height;
+	ok = fclose(_file) == 0 && ok;
+	_file = NULL;
+	return ok;
+}
+
+bool HdrWriter::writeHeader() {
+	vector<unsigned char> out;
+	putInt(out, 20000630); // magic number
+	putInt(out, 2); // version, scanline image
+
+	// Channels in the alphabetical order of their names, the order of the line planes
+	int colorType = _half ? EXR_HALF : EXR_FLOAT;
+	vector<unsigned char> channels;
+	if(_alpha) putChannel(channels, "A", EXR_FLOAT);
+	putChannel(channels, "B", colorType);
+	putChannel(channels, "G", colorType);
+	if(_aovs.normals) {
+		putChannel(channels, "N.X", EXR_FLOAT);
+		putChannel(channels, "N.Y", EXR_FLOAT);
+		putChannel(channels, "N.Z", EXR_FLOAT);
+	}
+	putChannel(channels, "R", colorType);
+	if(_aovs.depths) putChannel(channels, "Z", EXR_FLOAT);
+	if(_aovs.ids) putChannel(channels, "id", EXR_FLOAT);
+	channels.push_back(0);
+	putAttribute(out, "channels", "chlist", (int)channels.size());
+	out.insert(out.end(), channels.begin(), channels.end());
+
+	putAttribute(out, "compression", "compression", 1);
+	out.push_back(_rle ? 1 : 0);
+	const char* windows[2] = { "dataWindow", "displayWindow" };
+	for(int k = 0; k < 2; k++) {
+		putAttribute(out, windows[k], "box2i", 16);
+		putInt(out, 0);
+		putInt(out, 0);
+		putInt(out, _width-1);
+		putInt(out, _height-1);
+	}
+	putAttribute(out, "lineOrder", "lineOrder", 1);
+	out.push_back(0); // increasing y
+	putAttribute(out, "pixelAspectRatio", "float", 4);
+	putFloat(out, 1);
+	putAttribute(out, "screenWindowCenter", "v2f", 8);
+	putFloat(out, 0);
+	putFloat(out, 0);
+	putAttribute(out, "screenWindowWidth", "float", 4);
+	putFloat(out, 1);
+	out.push_back(0); // end of the header
+
+	return fwrite(&out[0], 1, out.size(), _file) == out.size();
+}
+
+int HdrWriter::lineSize() {
+	int channels = (_alpha ? 1 : 0) + (_aovs.normals ? 3 : 0) + (_aovs.depths ? 1 : 0) + (_aovs.ids ? 1 : 0);
+	return _width*(channels*4 + 3*(_half ? 2 : 4));
+}
+
+// Lays out row y of the image as one plane per channel, see writeHeader()
+void HdrWriter::fillLine(int y) {
+	unsigned char* p = &_line[0];
+	int size = _half ? 2 : 4;
+	unsigned char* alpha = NULL;
+	if(_alpha) {
+		alpha = p;
+		p += _width*4;
+	}
+	unsigned char* blue = p;
+	unsigned char* green = blue + _width*size;
+	unsigned char* normals = green + _width*size;
+	unsigned char* red = normals + (_aovs.normals ? _width*12 : 0);
+	p = red + _width*size;
+
+	if(_half) {
+		// Half bits are copied as they are, one tile run at a time
+		for(int x0 = 0; x0 < _width; x0 += FB_TILE) {
+			int n = min(FB_TILE, _width - x0);
+			const unsigned short* h = (const unsigned short*)_image->run(x0, y);
+			putPlane(red + x0*2, h, 2, 3, n);
+			putPlane(green + x0*2, h+1, 2, 3, n);
+			putPlane(blue + x0*2, h+2, 2, 3, n);
+		}
+	}
+	else {
+		int channels = _alpha ? 4 : 3;
+		_row.resize(_width*channels);
+		_image->readRows(y, y+1, &_row[0], channels);
+		putPlane(red, &_row[0], 4, channels, _width);
+		putPlane(green, &_row[1], 4, channels, _width);
+		putPlane(blue, &_row[2], 4, channels, _width);
+		if(_alpha)
+			putPlane(alpha, &_row[3], 4, 4, _width);
+	}
+
+	size_t k = (size_t)y*_width;
+	if(_aovs.normals)
+		for(int i = 0; i < 3; i++)
+			putPlane(normals + i*_width*4, _aovs.normals + k*3 + i, 4, 3, _width);
+	if(_aovs.depths) {
+		memcpy(p, _aovs.depths + k, _width*4);
+		p += _width*4;
+	}
+	if(_aovs.ids)
+		for(int x = 0; x < _width; x++) {
+			float id = (float)_aovs.ids[k + x];
+			memcpy(p + x*4, &id, 4);
+		}
+}
+
+/*
+ * OpenEXR's RLE: the bytes are split into even and odd ones, which puts
+ * the high bytes of the values together, stored as differences to the
+ * byte before, and runs of equal bytes are coded as count and byte. Lines
+ * that don't get smaller are stored as they are, which readers tell by
+ * their size.
+ */
+const vector<unsigned char>& HdrWriter::compressLine() {
+	size_t size = _line.size();
+	_split.resize(size);
+	for(size_t i = 0; i < size; i += 2)
+		_split[i/2] = _line[i];
+	for(size_t i = 1; i < size; i += 2)
+		_split[(size+1)/2 + i/2] = _line[i];
+	int prev = _split[0];
+	for(size_t i = 1; i < size; i++) {
+		int d = _split[i] - prev + 384;
+		prev = _split[i];
+		_split[i] = (unsigned char)d;
+	}
+
+	_packed.clear();
+	const unsigned char* in = &_split[0];
+	const unsigned char* end = in + size;
+	const unsigned char* start = in;
+	const unsigned char* stop = in + 1;
+	while(start < end) {
+		while(stop < end && *start == *stop && stop - start - 1 < RLE_MAX_RUN)
+			stop++;
+		if(stop - start >= RLE_MIN_RUN) {
+			_packed.push_back((unsigned char)(stop - start - 1));
+			_packed.push_back(*start);
+			start = stop;
+		}
+		else {
+			// Literal bytes up to the next run of three
+			while(stop < end && ((stop+1 >= end || stop[0] != stop[1]) || (stop+2 >= end || stop[1] != stop[2]))
+				&& stop - start < RLE_MAX_RUN)
+				stop++;
+			_packed.push_back((unsigned char)(start - stop));
+			_packed.insert(_packed.end(), start, stop);
+			start = stop;
+		}
+		stop++;
+		if(_packed.size() >= size) return _line;
+	}
+	return _packed;
+}
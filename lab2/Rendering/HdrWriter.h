@@ -0,0 +1,64 @@
+#ifndef HDR_WRITER_H
+#define HDR_WRITER_H
+
+#include "Rendering/Framebuffer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Float image file formats, picked by the file name's extension
+#define HDR_PFM 0 // portable float map, RGB floats
+#define HDR_EXR 1 // single-part OpenEXR scanline image
+
+// Per-pixel buffers saved next to the colors, indexed x + y*width like the
+// tracer's guide buffers; NULL ones are left out
+struct HdrAovs {
+	const float* depths; // distance to the primary hit, 0 for the background
+	const float* normals; // 3 floats per pixel
+	const int* ids; // object seen through the pixel, -1 for the background
+
+	HdrAovs() : depths(NULL), normals(NULL), ids(NULL) {}
+};
+
+/*
+ * Writes the linear colors of a framebuffer without clamping or encoding.
+ * Rows are read straight out of the tiles: float framebuffers are copied
+ * as they are, and EXR files keep the bits of half framebuffers, so only
+ * 8-bit framebuffers are converted on the way.
+ *
+ * PFM files hold RGB only; each AOV goes into a file of its own next to it,
+ * name.depth.pfm, name.normal.pfm and name.id.pfm. EXR files hold them as
+ * extra channels Z, N.X, N.Y, N.Z and id, uncompressed or RLE compressed.
+ */
+class HdrWriter {
+protected:
+	FILE* _file;
+	const Framebuffer* _image;
+	HdrAovs _aovs;
+	int _width, _height;
+	bool _half; // color channels stored as half, straight from the framebuffer
+	bool _alpha;
+	bool _rle;
+	std::vector<float> _row;
+	std::vector<unsigned char> _line, _split, _packed;
+
+	HdrWriter(const Framebuffer& image, const HdrAovs& aovs, bool rle);
+	~HdrWriter();
+
+	bool writePFM(const std::string& fname);
+	bool writePlane(const std::string& fname, const float* data, int channels);
+	bool writeIds(const std::string& fname);
+	bool writeEXR(const std::string& fname);
+	bool writeHeader();
+	int lineSize();
+	void fillLine(int y);
+	const std::vector<unsigned char>& compressLine();
+
+public:
+	// rle picks RLE over no compression for EXR files, PFM files are never compressed
+	static bool save(const std::string& fname, const Framebuffer& image, const HdrAovs& aovs = HdrAovs(), bool rle = true);
+	// Format named by the file's extension, -1 if none of them
+	static int formatOf(const std::string& fname);
+};
+
+#endif
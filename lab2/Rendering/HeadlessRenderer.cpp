@@ -0,0 +1,331 @@
+#include "Rendering/HeadlessRenderer.h"
+#include "Rendering/Wavefront.h"
+#include "Rendering/Antialias.h"
+#include "Rendering/Denoiser.h"
+#include "Rendering/Upsampler.h"
+#include "Rendering/ImageWriter.h"
+#include "Rendering/HdrWriter.h"
+#include "Rendering/Sampling.h"
+#include "Common/Common.h"
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <random>
+
+using namespace std;
+
+bool HeadlessRenderer::wantsHeadless(int argc, char** argv) {
+	return argc > 1 && (string(argv[1]) == "-render" || string(argv[1]) == "-test");
+}
+
+int HeadlessRenderer::run(int argc, char** argv) {
+	if(string(argv[1]) == "-test")
+		return runTest(argc, argv);
+
+	if(argc < 4) {
+		cout << "Usage: " << argv[0] << " -render scene.ray image.bmp [-size w h] [-packet n] [-wavefront] [-sort] [-raster] [-progressive] [-budget seconds] [-aa depth] [-aathreshold t] [-area samples] [-lights n] [-denoise passes] [-reduce n] [-format rgba32f|rgb32f|rgb16f|srgb8] [-stream rows] [-srgb] [-aov] [-uncompressed]" << endl;
+		return 1;
+	}
+
+	string input = argv[2];
+	string output = argv[3];
+	for(int j = 4; j < argc; j++) {
+		string opt = argv[j];
+		if(opt == "-size" && j+2 < argc) {
+			_width = atoi(argv[j+1]);
+			_height = atoi(argv[j+2]);
+			j += 2;
+		}
+		else if(opt == "-packet" && j+1 < argc)
+			_tracer.setPacketSize(atoi(argv[++j]));
+		else if(opt == "-wavefront")
+			_tracer.setMode(RT_MODE_WAVEFRONT);
+		else if(opt == "-sort")
+			_tracer.getWavefront()->setSortSecondary(true);
+		else if(opt == "-raster")
+			_tracer.setRasterPrimary(true);
+		else if(opt == "-progressive")
+			_tracer.setProgressive(true);
+		else if(opt == "-budget" && j+1 < argc)
+			_timeBudget = atof(argv[++j]);
+		else if(opt == "-aa" && j+1 < argc)
+			_tracer.getAntialiaser()->setMaxDepth(atoi(argv[++j]));
+		else if(opt == "-aathreshold" && j+1 < argc)
+			_tracer.getAntialiaser()->setThreshold(atof(argv[++j]));
+		else if(opt == "-area" && j+1 < argc)
+			_tracer.setAreaSamples(atoi(argv[++j]));
+		else if(opt == "-lights" && j+1 < argc)
+			_tracer.setLightBudget(atoi(argv[++j]));
+		else if(opt == "-denoise" && j+1 < argc)
+			_tracer.getDenoiser()->setIterations(atoi(argv[++j]));
+		else if(opt == "-reduce" && j+1 < argc)
+			_tracer.getUpsampler()->setReduction(atoi(argv[++j]));
+		else if(opt == "-format" && j+1 < argc) {
+			int format = Framebuffer::parseFormat(argv[++j]);
+			if(format < 0)
+				cout << "Ignoring unknown format " << argv[j] << endl;
+			else
+				_tracer.setFormat(format);
+		}
+		else if(opt == "-stream" && j+1 < argc)
+			_bandRows = atoi(argv[++j]);
+		else if(opt == "-srgb")
+			_srgb = true;
+		else if(opt == "-aov")
+			_aovs = true;
+		else if(opt == "-uncompressed")
+			_rle = false;
+		else
+			cout << "Ignoring unknown option " << opt << endl;
+	}
+
+	bool hdr = HdrWriter::formatOf(output) >= 0;
+	if(ImageWriter::formatOf(output) < 0 && !hdr) {
+		cout << "Images are written as .bmp, .png, .ppm, .pfm or .exr, " << output << " isn't" << endl;
+		return 1;
+	}
+	if(hdr && _bandRows > 0) {
+		cout << "Streamed renders are written as .bmp, .png or .ppm only" << endl;
+		return 1;
+	}
+
+	Scene* scene = SceneUtils::readScene(input);
+	if(!scene) {
+		cout << "Could not read " << input << endl;
+		return 1;
+	}
+
+	bool ok = _bandRows > 0 ? renderStreamed(scene, output) : render(scene, output);
+	delete scene;
+	return ok ? 0 : 1;
+}
+
+// Same camera as MainWindow: modelview = translate * rotate, gluPerspective(45, aspect, .1, 200),
+// with the aspect of the image so that non-square sizes aren't stretched
+void HeadlessRenderer::camera(Scene* scene, GLdouble glmv[16], GLdouble glproj[16]) {
+	Mat4 mv = (*scene->getTranslate()) * (*scene->getRotate());
+
+	double f = 1/tan(45*M_PI/360);
+	double aspect = (double)_width/_height;
+	double zNear = .1, zFar = 200;
+	Mat4 proj;
+	proj.clear();
+	proj[0][0] = f/aspect;
+	proj[1][1] = f;
+	proj[2][2] = (zFar+zNear)/(zNear-zFar);
+	proj[2][3] = -1;
+	proj[3][2] = 2*zFar*zNear/(zNear-zFar);
+
+	for(int i = 0; i < 16; i++) {
+		glmv[i] = mv[i>>2][i&3];
+		glproj[i] = proj[i>>2][i&3];
+	}
+}
+
+bool HeadlessRenderer::render(Scene* scene, const string& output) {
+	GLdouble glmv[16], glproj[16];
+	GLint view[4] = { 0, 0, _width, _height };
+	camera(scene, glmv, glproj);
+
+	_tracer.setScene(scene);
+	_tracer.drawInit(glmv, glproj, view);
+
+	cout << "Ray tracing " << _width << "x" << _height << "..." << endl;
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	if(_tracer.getProgressive() && _timeBudget > 0) {
+		while(!_tracer.draw(4096)) {
+			if(chrono::duration<double>(chrono::steady_clock::now() - begin).count() >= _timeBudget) {
+				cout << "Time budget reached after " << _tracer.getProgressLevel() << " of "
+					<< RT_PROGRESSIVE_LEVELS << " levels" << endl;
+				break;
+			}
+		}
+	}
+	else
+		while(!_tracer.draw(_width*_height));
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	cout << "Rendering time: " << seconds << "s" << endl;
+	cout << "Framebuffer: " << Framebuffer::formatName(_tracer.getFormat()) << ", "
+		<< _tracer.getImage().getBytes() / (1024.0*1024.0) << " MB" << endl;
+	if(_tracer.getMode() == RT_MODE_WAVEFRONT)
+		_tracer.getWavefront()->getStats().print();
+	_tracer.printShadowStats();
+	_tracer.printPrimaryStats();
+	_tracer.getUpsampler()->printStats();
+	_tracer.getAntialiaser()->printStats();
+	_tracer.getDenoiser()->printStats();
+
+	begin = chrono::steady_clock::now();
+	bool ok = _tracer.saveImage(output, _srgb, _aovs, _rle);
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	cout << "Saving time: " << seconds << "s" << endl;
+	return ok;
+}
+
+/*
+ * Traces the image in bands of _bandRows rows and appends each band to the
+ * file as soon as it is done, so only one band is ever held in memory
+ * however large the image. Bands go from the top down, or from the bottom
+ * up for BMP files, which store the rows that way. The rays are those of
+ * the whole image, so the file matches an image rendered at once;
+ * denoising and rasterized primary visibility need the whole image and
+ * are left out.
+ */
+bool HeadlessRenderer::renderStreamed(Scene* scene, const string& output) {
+	if(_tracer.getDenoiser()->getIterations() > 0 || _tracer.getRasterPrimary())
+		cout << "Denoising and rasterized primary visibility are off for streamed renders" << endl;
+	_tracer.getDenoiser()->setIterations(0);
+	_tracer.setRasterPrimary(false);
+
+	ImageWriter writer;
+	if(!writer.open(output, _width, _height, _srgb)) return false;
+	bool bottomUp = writer.isBottomUp();
+
+	GLdouble glmv[16], glproj[16];
+	GLint view[4] = { 0, 0, _width, _height };
+	camera(scene, glmv, glproj);
+	_tracer.setScene(scene);
+
+	cout << "Ray tracing " << _width << "x" << _height << " in bands of " << _bandRows << " rows..." << endl;
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	vector<float> pixels;
+	size_t peak = 0;
+	for(int k = 0; k*_bandRows < _height; k++) {
+		int y0 = bottomUp ? k*_bandRows : max(_height - (k+1)*_bandRows, 0);
+		int rows = min(_bandRows, bottomUp ? _height - y0 : _height - k*_bandRows);
+		_tracer.setBand(y0, rows);
+		_tracer.drawInit(glmv, glproj, view);
+		while(!_tracer.draw(_width*rows));
+		peak = max(peak, _tracer.getImage().getBytes());
+
+		// Converted one row at a time, the band stays in its pixel format
+		pixels.resize(_width*4);
+		for(int j = 0; j < rows; j++) {
+			int row = bottomUp ? j : rows-1 - j;
+			_tracer.getImage().readRows(row, row+1, &pixels[0]);
+			writer.writeRow(&pixels[0]);
+		}
+	}
+	_tracer.setBand(0, 0);
+	bool ok = writer.close();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	cout << "Rendering time: " << seconds << "s" << endl;
+	cout << "Framebuffer: " << Framebuffer::formatName(_tracer.getFormat()) << ", "
+		<< peak / (1024.0*1024.0) << " MB per band" << endl;
+	return ok;
+}
+
+int HeadlessRenderer::runTest(int argc, char** argv) {
+	if(argc < 3 || string(argv[2]) != "sampling") {
+		cout << "Usage: " << argv[0] << " -test sampling [scene.ray]" << endl;
+		return 1;
+	}
+
+	string input = argc > 3 ? argv[3] : "files/default.ray";
+	Scene* scene = SceneUtils::readScene(input);
+	if(!scene) {
+		cout << "Could not read " << input << endl;
+		return 1;
+	}
+
+	bool ok = testSampling(scene);
+	delete scene;
+	cout << (ok ? "PASSED" : "FAILED") << endl;
+	return ok ? 0 : 1;
+}
+
+// Average of n primary samples over the area of pixel (x, y), at the positions
+// of the table or at random ones when there is none
+static Color pixelAverage(Raytracer* tracer, int x, int y, int n, const SampleTable* table, mt19937& random) {
+	uniform_real_distribution<double> uniform(0, 1);
+	Color sum(0, 0, 0);
+	for(int i = 0; i < n; i++) {
+		double u, v;
+		if(table)
+			table->get(x, y, i, u, v);
+		else {
+			u = uniform(random);
+			v = uniform(random);
+		}
+		Ray ray = tracer->primaryRay(x+u, y+v);
+		HitRecord hit;
+		if(tracer->intersect(ray, hit, tracer->primaryCandidates(x, y))) {
+			Color c = tracer->shade(ray, hit, 0, 1.0).color;
+			for(int k = 0; k < 3; k++)
+				sum[k] += c[k];
+		}
+	}
+	for(int k = 0; k < 3; k++)
+		sum[k] /= n;
+	return sum;
+}
+
+/*
+ * Error against sample count of the sample tables. Every pixel of a 120x120
+ * render averages N = 1, 4, 16 and 64 primary samples over its area and is
+ * compared with a 1024-sample stratified reference. Passes when the RMS
+ * error of every pattern falls as N grows and all tables beat independent
+ * random samples at 64.
+ */
+bool HeadlessRenderer::testSampling(Scene* scene) {
+	const int size = 120;
+	const int counts[4] = { 1, 4, 16, 64 };
+	const char* names[4] = { "random", "stratified", "Sobol", "blue noise" };
+	const int types[4] = { -1, SAMPLE_STRATIFIED, SAMPLE_SOBOL, SAMPLE_BLUE_NOISE };
+
+	setSize(size, size);
+	GLdouble glmv[16], glproj[16];
+	GLint view[4] = { 0, 0, size, size };
+	camera(scene, glmv, glproj);
+	_tracer.setScene(scene);
+	_tracer.drawInit(glmv, glproj, view);
+
+	mt19937 random(1);
+	SampleTable reference(SAMPLE_STRATIFIED, 1024);
+	vector<Color> expected(size*size);
+	for(int y = 0; y < size; y++)
+		for(int x = 0; x < size; x++)
+			expected[x + y*size] = pixelAverage(&_tracer, x, y, reference.getCount(), &reference, random);
+
+	cout << "RMS error against sample count on " << size << "x" << size << " pixels:" << endl;
+	cout << setw(12) << "";
+	for(int n = 0; n < 4; n++)
+		cout << setw(10) << ("N=" + to_string(counts[n]));
+	cout << endl;
+
+	bool ok = true;
+	double randomError = 0;
+	for(int p = 0; p < 4; p++) {
+		cout << setw(12) << left << names[p] << right << fixed << setprecision(4);
+		double last = DINF;
+		for(int n = 0; n < 4; n++) {
+			SampleTable table(types[p] < 0 ? SAMPLE_SOBOL : types[p], counts[n]);
+			double sum = 0;
+			for(int y = 0; y < size; y++) {
+				for(int x = 0; x < size; x++) {
+					Color c = pixelAverage(&_tracer, x, y, counts[n], types[p] < 0 ? NULL : &table, random);
+					for(int k = 0; k < 3; k++) {
+						double d = c[k] - expected[x + y*size][k];
+						sum += d*d;
+					}
+				}
+			}
+			double error = sqrt(sum / (size*size*3));
+			cout << setw(10) << error;
+			ok = ok && error < last;
+			last = error;
+		}
+		cout << endl;
+		if(p == 0)
+			randomError = last;
+		else
+			ok = ok && last < randomError;
+	}
+	cout.unsetf(ios::floatfield);
+	return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef HEADLESS_RENDERER_H
+#define HEADLESS_RENDERER_H
+
+#include "Rendering/Raytracer.h"
+#include <string>
+
+/*
+ * Renders a scene file straight to an image without opening any window:
+ *   Lab -render scene.ray image.bmp [-size w h] [-packet n] [-wavefront] [-sort] [-raster]
+ *                  [-progressive] [-budget seconds] [-aa depth] [-aathreshold t]
+ *                  [-area samples] [-lights n] [-denoise passes] [-reduce n]
+ *                  [-format rgba32f|rgb32f|rgb16f|srgb8] [-stream rows] [-srgb]
+ *                  [-aov] [-uncompressed]
+ * The camera is the one stored in the scene file with the same perspective
+ * projection as the main window, which makes it handy for timing renders at
+ * resolutions larger than the screen. The image is a BMP, PNG or PPM file,
+ * picked by the extension, with sRGB-encoded colors when -srgb is given,
+ * or a PFM or EXR file of the linear float colors. -aov adds the depth,
+ * normal and object ID buffers to those, and EXR files are RLE compressed
+ * unless -uncompressed is given.
+ * With -stream it is traced in bands of the given number of rows, each
+ * written to the file when done, for images too large to keep in memory;
+ * it only writes 8-bit files.
+ *
+ *   Lab -test sampling [scene.ray]
+ * checks that the sample tables converge, see testSampling(); it exits
+ * with 1 when they don't.
+ */
+class HeadlessRenderer {
+protected:
+	Raytracer _tracer;
+	int _width;
+	int _height;
+	double _timeBudget; // seconds, 0 renders to completion
+	int _bandRows; // rows per band of streamed renders, 0 renders the image at once
+	bool _srgb; // encode the saved colors as sRGB
+	bool _aovs; // save the depth, normal and object buffers with float images
+	bool _rle; // compress EXR files
+
+	void camera(Scene* scene, GLdouble glmv[16], GLdouble glproj[16]);
+	int runTest(int argc, char** argv);
+	bool testSampling(Scene* scene);
+
+public:
+	HeadlessRenderer() : _width(600), _height(600), _timeBudget(0), _bandRows(0), _srgb(false), _aovs(false), _rle(true) {}
+
+	static bool wantsHeadless(int argc, char** argv);
+	int run(int argc, char** argv);
+
+	bool render(Scene* scene, const std::string& output);
+	// Renders band by band straight to the file, see -stream
+	bool renderStreamed(Scene* scene, const std::string& output);
+
+	Raytracer* getRaytracer() { return &_tracer; }
+	void setSize(int w, int h) { _width = w; _height = h; }
+};
+
+#endif
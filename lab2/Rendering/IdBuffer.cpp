@@ -0,0 +1,113 @@
+#include "Rendering/IdBuffer.h"
+#include "Common/Common.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void IdBuffer::begin(const Mat4& final, const GLint view[4]) {
+	_final = final;
+	for(int i = 0; i < 4; i++)
+		_view[i] = view[i];
+
+	_width = view[2];
+	_height = view[3];
+	_ids.assign(_width*_height, -1);
+	_depth.assign(_width*_height, DINF);
+	_ids2.assign(_width*_height, -1);
+	_depth2.assign(_width*_height, DINF);
+}
+
+void IdBuffer::draw(int object, const vector<Pt3>& triangles) {
+	for(size_t k = 0; k+2 < triangles.size(); k += 3) {
+		Pt3 clip[3];
+		for(int j = 0; j < 3; j++)
+			clip[j] = triangles[k+j]*_final;
+		drawTriangle(object, clip);
+	}
+}
+
+// Clips against the near plane (z >= -w in clip space) before drawing
+void IdBuffer::drawTriangle(int object, const Pt3 clip[3]) {
+	Pt3 out[4];
+	int n = 0;
+	for(int j = 0; j < 3; j++) {
+		const Pt3& a = clip[j];
+		const Pt3& b = clip[(j+1) % 3];
+		double da = a[2] + a[3], db = b[2] + b[3];
+		if(da >= 0) out[n++] = a;
+		if((da >= 0) != (db >= 0)) {
+			double s = da / (da - db);
+			Pt3 p = a;
+			for(int i = 0; i < 4; i++)
+				p[i] = a[i] + s*(b[i] - a[i]);
+			out[n++] = p;
+		}
+	}
+	if(n >= 3)
+		drawClipped(object, out, n);
+}
+
+void IdBuffer::drawClipped(int object, const Pt3* clip, int n) {
+	// Pixel coordinates from the viewport's corner; z is the window depth in [0, 1]
+	double x[4], y[4], z[4];
+	for(int j = 0; j < n; j++) {
+		double w = clip[j][3];
+		if(w <= 0) return; // can only happen for degenerate projections
+		x[j] = (clip[j][0]/w + 1)/2 * _view[2];
+		y[j] = (clip[j][1]/w + 1)/2 * _view[3];
+		z[j] = (clip[j][2]/w + 1)/2;
+	}
+
+	// Fan of triangles around the first vertex
+	for(int t = 1; t+1 < n; t++) {
+		int v[3] = { 0, t, t+1 };
+		double area = (x[v[1]]-x[v[0]])*(y[v[2]]-y[v[0]]) - (y[v[1]]-y[v[0]])*(x[v[2]]-x[v[0]]);
+		if(fabs(area) < 1e-12) continue;
+
+		double xmin = min(x[v[0]], min(x[v[1]], x[v[2]]));
+		double xmax = max(x[v[0]], max(x[v[1]], x[v[2]]));
+		double ymin = min(y[v[0]], min(y[v[1]], y[v[2]]));
+		double ymax = max(y[v[0]], max(y[v[1]], y[v[2]]));
+		int px0 = max(0, (int)ceil(xmin)), px1 = min(_width-1, (int)floor(xmax));
+		int py0 = max(0, (int)ceil(ymin)), py1 = min(_height-1, (int)floor(ymax));
+
+		for(int py = py0; py <= py1; py++) {
+			for(int px = px0; px <= px1; px++) {
+				// Barycentric weights, non-negative inside for either winding
+				double b[3];
+				bool inside = true;
+				for(int e = 0; e < 3 && inside; e++) {
+					int i0 = v[(e+1) % 3], i1 = v[(e+2) % 3];
+					b[e] = ((x[i1]-x[i0])*(py-y[i0]) - (y[i1]-y[i0])*(px-x[i0])) / area;
+					inside = b[e] >= -1e-9;
+				}
+				if(!inside) continue;
+
+				double depth = b[0]*z[v[0]] + b[1]*z[v[1]] + b[2]*z[v[2]];
+				int offset = px + py*_width;
+				if(object == _ids[offset])
+					_depth[offset] = min(_depth[offset], depth);
+				else if(depth < _depth[offset]) {
+					// The object in front becomes the closest other one
+					_depth2[offset] = _depth[offset];
+					_ids2[offset] = _ids[offset];
+					_depth[offset] = depth;
+					_ids[offset] = object;
+				}
+				else if(depth < _depth2[offset]) {
+					_depth2[offset] = depth;
+					_ids2[offset] = object;
+				}
+			}
+		}
+	}
+}
+
+bool IdBuffer::isInterior(int x, int y) const {
+	int id = getObject(x, y);
+	for(int j = max(0, y-1); j <= min(_height-1, y+1); j++)
+		for(int i = max(0, x-1); i <= min(_width-1, x+1); i++)
+			if(_ids[i + j*_width] != id) return false;
+	return true;
+}
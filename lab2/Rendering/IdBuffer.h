@@ -0,0 +1,49 @@
+#ifndef ID_BUFFER_H
+#define ID_BUFFER_H
+
+#include "Rendering/Geometry.h"
+#include <FL/gl.h>
+#include <vector>
+
+/*
+ * Software z-buffer that stores, for every pixel, the index of the closest
+ * object and its window depth (0 at the near plane, 1 at the far plane).
+ * Pixels are sampled at integer coordinates from the viewport's lower left
+ * corner, like the primary rays of Raytracer. Next to the closest object each
+ * pixel also keeps the closest other object behind it, which tells pixels
+ * where two surfaces nearly touch. Triangles are clipped against the near plane, the far plane
+ * is ignored because rays don't stop there either.
+ */
+class IdBuffer {
+protected:
+	int _width;
+	int _height;
+	std::vector<int> _ids; // -1 where nothing was drawn
+	std::vector<double> _depth;
+	// Closest object other than the one in _ids, -1 and DINF when there is none
+	std::vector<int> _ids2;
+	std::vector<double> _depth2;
+
+	Mat4 _final;
+	GLint _view[4];
+
+	void drawTriangle(int object, const Pt3 clip[3]);
+	void drawClipped(int object, const Pt3* clip, int n);
+
+public:
+	IdBuffer() : _width(0), _height(0) {}
+
+	// Clears the buffer for a new frame with the given view-projection matrix
+	void begin(const Mat4& final, const GLint view[4]);
+	// Draws a world-space triangle list (three points per triangle) of one object
+	void draw(int object, const std::vector<Pt3>& triangles);
+
+	int getObject(int x, int y) const { return _ids[x + y*_width]; }
+	double getDepth(int x, int y) const { return _depth[x + y*_width]; }
+	int getSecondObject(int x, int y) const { return _ids2[x + y*_width]; }
+	double getSecondDepth(int x, int y) const { return _depth2[x + y*_width]; }
+	// True when all pixels of the 3x3 block around (x, y) show the same object
+	bool isInterior(int x, int y) const;
+};
+
+#endif
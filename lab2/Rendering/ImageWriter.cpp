@@ -0,0 +1,304 @@
+#include "Rendering/ImageWriter.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+// Largest stored deflate block
+#define PNG_BLOCK 65535
+// sRGB codes of linear values in steps of 1/SRGB_STEPS
+#define SRGB_STEPS 65535
+
+static unsigned char srgbCodes[SRGB_STEPS+1];
+static unsigned int crcTable[256];
+
+static bool fillTables() {
+	for(int k = 0; k <= SRGB_STEPS; k++) {
+		double c = (double)k/SRGB_STEPS;
+		c = c <= 0.0031308 ? 12.92*c : 1.055*pow(c, 1/2.4) - 0.055;
+		srgbCodes[k] = (unsigned char)(c*255 + 0.5);
+	}
+	for(unsigned int n = 0; n < 256; n++) {
+		unsigned int c = n;
+		for(int k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+	return true;
+}
+// Filled before main() so that saving threads never race to fill them
+static bool tablesFilled = fillTables();
+
+static unsigned int crc32(unsigned int crc, const unsigned char* p, size_t n) {
+	crc = ~crc;
+	while(n--)
+		crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static unsigned int adler32(unsigned int adler, const unsigned char* p, size_t n) {
+	unsigned int a = adler & 0xffff, b = adler >> 16;
+	while(n > 0) {
+		// Largest run whose sums can't overflow before the modulo
+		size_t k = min(n, (size_t)5552);
+		n -= k;
+		while(k--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static void putLE(unsigned char* p, unsigned int v, int bytes) {
+	for(int k = 0; k < bytes; k++)
+		p[k] = (unsigned char)(v >> (8*k));
+}
+
+static void putBE(unsigned char* p, unsigned int v) {
+	for(int k = 0; k < 4; k++)
+		p[k] = (unsigned char)(v >> (8*(3-k)));
+}
+
+/*
+ * Runs of pixels are first clamped and scaled to integer codes in a loop
+ * over plain floats, which compilers vectorize, and then packed.
+ */
+void ImageWriter::toBytes(const float* rgba, int count, unsigned char* out, bool srgb, bool bgr) {
+	const int run = 64;
+	int codes[run*4];
+	const float scale = srgb ? (float)SRGB_STEPS : 255.f;
+	int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+	for(int i0 = 0; i0 < count; i0 += run) {
+		int n = min(run, count - i0);
+		const float* src = rgba + i0*4;
+		for(int k = 0; k < n*4; k++) {
+			float v = src[k];
+			v = v > 0 ? v : 0.f; // also sends NaN to 0
+			v = v < 1 ? v : 1.f;
+			codes[k] = (int)(v*scale + 0.5f);
+		}
+		unsigned char* dst = out + i0*3;
+		if(srgb) {
+			for(int i = 0; i < n; i++) {
+				dst[i*3 + r] = srgbCodes[codes[i*4]];
+				dst[i*3 + 1] = srgbCodes[codes[i*4 + 1]];
+				dst[i*3 + b] = srgbCodes[codes[i*4 + 2]];
+			}
+		}
+		else {
+			for(int i = 0; i < n; i++) {
+				dst[i*3 + r] = (unsigned char)codes[i*4];
+				dst[i*3 + 1] = (unsigned char)codes[i*4 + 1];
+				dst[i*3 + b] = (unsigned char)codes[i*4 + 2];
+			}
+		}
+	}
+}
+
+int ImageWriter::formatOf(const string& fname) {
+	size_t dot = fname.rfind('.');
+	if(dot == string::npos) return -1;
+	string ext = fname.substr(dot+1);
+	for(size_t k = 0; k < ext.size(); k++)
+		ext[k] = (char)tolower(ext[k]);
+	if(ext == "bmp") return IMAGE_BMP;
+	if(ext == "ppm") return IMAGE_PPM;
+	if(ext == "png") return IMAGE_PNG;
+	return -1;
+}
+
+ImageWriter::ImageWriter() : _file(NULL), _format(-1), _width(0), _height(0), _rows(0), _srgb(false),
+	_adler(1), _firstBlock(true) {}
+
+ImageWriter::~ImageWriter() {
+	if(_file) fclose(_file);
+}
+
+int ImageWriter::lineSize() {
+	switch(_format) {
+	case IMAGE_BMP: return (_width*3 + 3) & ~3;
+	case IMAGE_PNG: return 1 + _width*3;
+	default: return _width*3;
+	}
+}
+
+void ImageWriter::convertRow(const float* rgba, unsigned char* line) {
+	switch(_format) {
+	case IMAGE_BMP:
+		toBytes(rgba, _width, line, _srgb, true);
+		memset(line + _width*3, 0, lineSize() - _width*3);
+		break;
+	case IMAGE_PNG:
+		line[0] = 0; // no filter
+		toBytes(rgba, _width, line+1, _srgb);
+		break;
+	default:
+		toBytes(rgba, _width, line, _srgb);
+	}
+}
+
+bool ImageWriter::open(const string& fname, int width, int height, bool srgb) {
+	if(_file) close();
+	_format = formatOf(fname);
+	if(_format < 0 || width <= 0 || height <= 0) return false;
+	_file = fopen(fname.c_str(), "wb");
+	if(!_file) return false;
+
+	_width = width;
+	_height = height;
+	_rows = 0;
+	_srgb = srgb;
+	_line.resize(lineSize());
+	_pending.clear();
+	_adler = 1;
+	_firstBlock = true;
+	return writeHeader();
+}
+
+bool ImageWriter::writeHeader() {
+	if(_format == IMAGE_PPM)
+		return fprintf(_file, "P6\n%d %d\n255\n", _width, _height) > 0;
+
+	if(_format == IMAGE_BMP) {
+		unsigned char header[54] = { 'B', 'M' };
+		unsigned int image = (unsigned int)lineSize()*_height;
+		putLE(header+2, 54 + image, 4);
+		putLE(header+10, 54, 4);
+		putLE(header+14, 40, 4);
+		putLE(header+18, _width, 4);
+		putLE(header+22, _height, 4);
+		putLE(header+26, 1, 2); // planes
+		putLE(header+28, 24, 2); // bits per pixel
+		putLE(header+34, image, 4);
+		putLE(header+38, 2835, 4); // 72 dpi
+		putLE(header+42, 2835, 4);
+		return fwrite(header, 1, 54, _file) == 54;
+	}
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned char ihdr[13] = { 0 };
+	putBE(ihdr, _width);
+	putBE(ihdr+4, _height);
+	ihdr[8] = 8; // bits per channel
+	ihdr[9] = 2; // RGB
+	unsigned char intent = 0; // perceptual
+	return fwrite(signature, 1, 8, _file) == 8 && writeChunk("IHDR", ihdr, 13)
+		&& (!_srgb || writeChunk("sRGB", &intent, 1));
+}
+
+bool ImageWriter::writeRow(const float* rgba) {
+	if(!_file || _rows >= _height) return false;
+	convertRow(rgba, &_line[0]);
+	_rows++;
+	if(_format == IMAGE_PNG)
+		return putData(&_line[0], _line.size());
+	return fwrite(&_line[0], 1, _line.size(), _file) == _line.size();
+}
+
+bool ImageWriter::close() {
+	if(!_file) return false;
+	bool ok = _rows == _height;
+	if(_format == IMAGE_PNG)
+		ok = flushBlock(true) && writeChunk("IEND", NULL, 0) && ok;
+	ok = !ferror(_file) && ok;
+	ok = fclose(_file) == 0 && ok;
+	_file = NULL;
+	return ok;
+}
+
+// Deflate input of a PNG, cut into stored blocks of PNG_BLOCK bytes
+bool ImageWriter::putData(const unsigned char* data, size_t size) {
+	bool ok = true;
+	while(size > 0) {
+		size_t n = min(size, PNG_BLOCK - _pending.size());
+		_pending.insert(_pending.end(), data, data+n);
+		_adler = adler32(_adler, data, n);
+		data += n;
+		size -= n;
+		if(_pending.size() == PNG_BLOCK)
+			ok = flushBlock(false) && ok;
+	}
+	return ok;
+}
+
+/*
+ * Each stored block goes into an IDAT chunk of its own, which PNG allows,
+ * so no chunk length has to be known before the image is done. The first
+ * one starts with the zlib header, the last one ends with the Adler-32 of
+ * the uncompressed data.
+ */
+bool ImageWriter::flushBlock(bool last) {
+	unsigned int n = (unsigned int)_pending.size();
+	vector<unsigned char> chunk;
+	chunk.reserve(n + 11);
+	if(_firstBlock) {
+		chunk.push_back(0x78); // deflate, 32K window
+		chunk.push_back(0x01); // no dictionary, header check
+		_firstBlock = false;
+	}
+	unsigned char block[5] = { (unsigned char)(last ? 1 : 0) };
+	putLE(block+1, n, 2);
+	putLE(block+3, ~n & 0xffff, 2);
+	chunk.insert(chunk.end(), block, block+5);
+	chunk.insert(chunk.end(), _pending.begin(), _pending.end());
+	if(last) {
+		unsigned char adler[4];
+		putBE(adler, _adler);
+		chunk.insert(chunk.end(), adler, adler+4);
+	}
+	_pending.clear();
+	return writeChunk("IDAT", &chunk[0], chunk.size());
+}
+
+bool ImageWriter::writeChunk(const char* type, const unsigned char* data, size_t size) {
+	unsigned char head[8];
+	putBE(head, (unsigned int)size);
+	memcpy(head+4, type, 4);
+	unsigned int crc = crc32(crc32(0, head+4, 4), data, size);
+	unsigned char tail[4];
+	putBE(tail, crc);
+	return fwrite(head, 1, 8, _file) == 8 && (size == 0 || fwrite(data, 1, size, _file) == size)
+		&& fwrite(tail, 1, 4, _file) == 4;
+}
+
+// Converts rows [k0, k1) of the file, numbered in file order, into their place in data
+void ImageWriter::convertRows(const Framebuffer* image, unsigned char* data, int k0, int k1) {
+	int size = lineSize();
+	vector<float> rgba(_width*4);
+	for(int k = k0; k < k1; k++) {
+		int y = isBottomUp() ? k : _height-1 - k;
+		image->readRows(y, y+1, &rgba[0]);
+		convertRow(&rgba[0], data + (size_t)k*size);
+	}
+}
+
+bool ImageWriter::save(const string& fname, const Framebuffer& image, bool srgb) {
+	if(image.empty()) return false;
+	ImageWriter writer;
+	if(!writer.open(fname, image.getWidth(), image.getHeight(), srgb)) return false;
+
+	int height = image.getHeight();
+	int size = writer.lineSize();
+	vector<unsigned char> data((size_t)size*height);
+	int numThreads = max(1, (int)thread::hardware_concurrency());
+	numThreads = min(numThreads, height);
+	vector<thread> threads;
+	for(int t = 1; t < numThreads; t++)
+		threads.push_back(thread(&ImageWriter::convertRows, &writer, &image, &data[0], height*t/numThreads, height*(t+1)/numThreads));
+	writer.convertRows(&image, &data[0], 0, height/numThreads);
+	for(size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	writer._rows = height;
+	if(writer._format == IMAGE_PNG)
+		writer.putData(&data[0], data.size());
+	else
+		fwrite(&data[0], 1, data.size(), writer._file);
+	return writer.close();
+}
@@ -0,0 +1,67 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "Rendering/Framebuffer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 8-bit image file formats, picked by the file name's extension
+#define IMAGE_BMP 0 // 24-bit, rows bottom-up
+#define IMAGE_PPM 1 // binary P6
+#define IMAGE_PNG 2 // 8-bit RGB, stored (uncompressed) deflate blocks
+
+/*
+ * Writes RGB images with 8 bits per channel from RGBA float pixels. Colors
+ * are clamped to [0, 1] and rounded, optionally sRGB encoded on the way.
+ *
+ * save() writes a whole framebuffer: its rows are converted straight into
+ * the layout of the file, split between one thread per core, and written
+ * at once. Images can also be streamed row by row with open(), writeRow()
+ * and close(), in the order the file stores them (see isBottomUp()), which
+ * keeps no more than a row and a deflate block in memory.
+ */
+class ImageWriter {
+protected:
+	FILE* _file;
+	int _format;
+	int _width, _height;
+	int _rows; // written so far
+	bool _srgb;
+	std::vector<unsigned char> _line;
+
+	// PNG: deflate input not written yet, at most one stored block, and the
+	// Adler-32 of all of it
+	std::vector<unsigned char> _pending;
+	unsigned int _adler;
+	bool _firstBlock;
+
+	bool writeHeader();
+	int lineSize();
+	void convertRow(const float* rgba, unsigned char* line);
+	void convertRows(const Framebuffer* image, unsigned char* data, int k0, int k1);
+	bool putData(const unsigned char* data, size_t size);
+	bool flushBlock(bool last);
+	bool writeChunk(const char* type, const unsigned char* data, size_t size);
+
+public:
+	ImageWriter();
+	~ImageWriter();
+
+	// Starts a file of the format its extension names; false when it can't be created
+	bool open(const std::string& fname, int width, int height, bool srgb = false);
+	// Rows go bottom-up into BMP files and top-down into the others
+	bool isBottomUp() { return _format == IMAGE_BMP; }
+	// The next row of the file, width RGBA floats
+	bool writeRow(const float* rgba);
+	// Finishes the file; false when any write failed or rows are missing
+	bool close();
+
+	static bool save(const std::string& fname, const Framebuffer& image, bool srgb = false);
+	// Format named by the file's extension, -1 if none of them
+	static int formatOf(const std::string& fname);
+	// Clamped 8-bit RGB (BGR when bgr is set) of count RGBA float pixels
+	static void toBytes(const float* rgba, int count, unsigned char* out, bool srgb, bool bgr = false);
+};
+
+#endif
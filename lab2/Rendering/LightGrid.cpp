@@ -0,0 +1,87 @@
+#include "Rendering/LightGrid.h"
+#include "Rendering/ShadeAndShapes.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace std;
+
+// Whether the sphere overlaps the box [lo, hi]
+static bool sphereTouches(const Pt3& c, double r, const Pt3& lo, const Pt3& hi) {
+	double d2 = 0;
+	for(int i = 0; i < 3; i++) {
+		double d = c[i] < lo[i] ? lo[i] - c[i] : (c[i] > hi[i] ? c[i] - hi[i] : 0);
+		d2 += d*d;
+	}
+	return d2 <= r*r;
+}
+
+LightGrid::LightGrid() {
+	_res[0] = _res[1] = _res[2] = 0;
+	_cellSize[0] = _cellSize[1] = _cellSize[2] = 0;
+}
+
+/*
+ * The grid covers the union of the ranged lights' spheres, with about two
+ * cells per ranged light along each axis of a cube of the same volume.
+ */
+void LightGrid::build(const vector<Light*>& lights) {
+	_cells.clear();
+	_unlimited.clear();
+	_box = BoundingBox();
+
+	vector<int> ranged;
+	for(int i = 0; i < (int)lights.size(); i++) {
+		double r = lights[i]->getRange();
+		if(r > 0) {
+			ranged.push_back(i);
+			_box.extend(lights[i]->getPos() - Vec3(r, r, r, 0));
+			_box.extend(lights[i]->getPos() + Vec3(r, r, r, 0));
+		} else {
+			_unlimited.push_back(i);
+		}
+	}
+	if(ranged.empty()) return;
+
+	Vec3 size = _box.max - _box.min;
+	double longest = max(size[0], max(size[1], size[2]));
+	int target = (int)ceil(2*cbrt((double)ranged.size()));
+	for(int i = 0; i < 3; i++) {
+		_res[i] = (int)ceil(target * size[i] / longest);
+		_res[i] = _res[i] < 1 ? 1 : (_res[i] > LIGHT_GRID_MAX_RES ? LIGHT_GRID_MAX_RES : _res[i]);
+		_cellSize[i] = size[i] / _res[i];
+	}
+
+	_cells.assign(_res[0]*_res[1]*_res[2], vector<int>());
+	for(int z = 0; z < _res[2]; z++) {
+		for(int y = 0; y < _res[1]; y++) {
+			for(int x = 0; x < _res[0]; x++) {
+				Pt3 lo(_box.min[0] + x*_cellSize[0], _box.min[1] + y*_cellSize[1], _box.min[2] + z*_cellSize[2]);
+				Pt3 hi(lo[0] + _cellSize[0], lo[1] + _cellSize[1], lo[2] + _cellSize[2]);
+
+				vector<int> reach;
+				for(int k = 0; k < (int)ranged.size(); k++) {
+					const Light* light = lights[ranged[k]];
+					if(sphereTouches(light->getPos(), light->getRange(), lo, hi))
+						reach.push_back(ranged[k]);
+				}
+
+				vector<int>& cell = _cells[(z*_res[1] + y)*_res[0] + x];
+				cell.reserve(reach.size() + _unlimited.size());
+				merge(reach.begin(), reach.end(), _unlimited.begin(), _unlimited.end(), back_inserter(cell));
+			}
+		}
+	}
+}
+
+const vector<int>& LightGrid::lights(const Pt3& p) const {
+	if(_cells.empty() || !_box.contains(p))
+		return _unlimited;
+
+	int c[3];
+	for(int i = 0; i < 3; i++) {
+		c[i] = _cellSize[i] > 0 ? (int)((p[i] - _box.min[i]) / _cellSize[i]) : 0;
+		c[i] = c[i] < 0 ? 0 : (c[i] >= _res[i] ? _res[i]-1 : c[i]);
+	}
+	return _cells[(c[2]*_res[1] + c[1])*_res[0] + c[0]];
+}
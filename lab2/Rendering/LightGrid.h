@@ -0,0 +1,38 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include "Rendering/Geometry.h"
+#include <vector>
+
+class Light;
+
+// Largest number of cells along each axis
+#define LIGHT_GRID_MAX_RES 32
+
+/*
+ * Uniform grid over the spheres of influence of the lights with a limited
+ * range. Every cell lists the lights that can reach some point in it: the
+ * lights without a range plus the ranged ones whose sphere overlaps the
+ * cell. Points outside the grid only see the unlimited lights. Lists are in
+ * scene order, so shading sums the lights in the same order as before.
+ */
+class LightGrid {
+protected:
+	BoundingBox _box;
+	int _res[3];
+	double _cellSize[3];
+	std::vector<std::vector<int> > _cells;
+	std::vector<int> _unlimited; // lights without a range, all lights when none has one
+
+public:
+	LightGrid();
+
+	void build(const std::vector<Light*>& lights);
+	// True when some light has a range, i.e. lights() can leave lights out
+	bool active() const { return !_cells.empty(); }
+
+	// Lights that can reach point p
+	const std::vector<int>& lights(const Pt3& p) const;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "Rendering/LightTree.h"
+#include "Rendering/ShadeAndShapes.h"
+#include "Common/Common.h"
+#include <algorithm>
+
+using namespace std;
+
+// Luminance of the light's color
+static double lightPower(const Light* light) {
+	const Color& c = light->getColor();
+	return 0.2126*c[0] + 0.7152*c[1] + 0.0722*c[2];
+}
+
+void LightTree::build(const vector<Light*>& lights) {
+	_nodes.clear();
+
+	// Lights without power add nothing to the image, so they are never picked
+	vector<int> ids;
+	for(int i = 0; i < (int)lights.size(); i++)
+		if(lightPower(lights[i]) > 0) ids.push_back(i);
+	if(ids.empty()) return;
+
+	_nodes.reserve(2*ids.size() - 1);
+	build(ids, 0, (int)ids.size(), lights);
+}
+
+// Splits the lights at the median of the longest axis of their bounds
+int LightTree::build(vector<int>& ids, int begin, int end, const vector<Light*>& all) {
+	int index = (int)_nodes.size();
+	_nodes.push_back(Node());
+
+	BoundingBox box;
+	double power = 0;
+	for(int k = begin; k < end; k++) {
+		const Light* light = all[ids[k]];
+		double r = light->getExtent();
+		box.extend(light->getPos() - Vec3(r, r, r, 0));
+		box.extend(light->getPos() + Vec3(r, r, r, 0));
+		power += lightPower(light);
+	}
+
+	Node node;
+	node.center = box.center();
+	node.radius = box.radius();
+	node.power = power;
+	node.reach = 0;
+	for(int k = begin; k < end; k++) {
+		const Light* light = all[ids[k]];
+		double reach = light->getRange() > 0 ? mag(light->getPos() - node.center) + light->getRange() : DINF;
+		node.reach = max(node.reach, reach);
+	}
+	node.left = node.right = node.light = -1;
+
+	if(end - begin == 1) {
+		node.light = ids[begin];
+	} else {
+		Vec3 size = box.max - box.min;
+		int axis = 0;
+		for(int i = 1; i < 3; i++)
+			if(size[i] > size[axis]) axis = i;
+
+		int mid = (begin + end)/2;
+		nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+			[&](int a, int b) { return all[a]->getPos()[axis] < all[b]->getPos()[axis]; });
+		node.left = build(ids, begin, mid, all);
+		node.right = build(ids, mid, end, all);
+	}
+	_nodes[index] = node;
+	return index;
+}
+
+// Power over squared distance, with the distance kept outside the node's sphere
+double LightTree::importance(const Node& node, const Pt3& p) const {
+	double d2 = mag2(p - node.center);
+	if(d2 >= node.reach*node.reach) return 0;
+	double r2 = node.radius*node.radius;
+	return node.power / max(max(d2, r2), 1e-4);
+}
+
+int LightTree::sample(const Pt3& p, double u, double& pdf) const {
+	pdf = 0;
+	if(_nodes.empty()) return -1;
+
+	// u is rescaled at every step, so stratified u's stay stratified over the leaves
+	pdf = 1;
+	int k = 0;
+	while(_nodes[k].light < 0) {
+		const Node& node = _nodes[k];
+		double il = importance(_nodes[node.left], p);
+		double ir = importance(_nodes[node.right], p);
+		if(il + ir == 0) {
+			pdf = 0;
+			return -1;
+		}
+		double pl = il / (il + ir);
+		if(u < pl) {
+			u = u / pl;
+			pdf *= pl;
+			k = node.left;
+		} else {
+			u = (u - pl) / (1 - pl);
+			pdf *= 1 - pl;
+			k = node.right;
+		}
+		if(u >= 1) u = 0.999999999;
+	}
+	return _nodes[k].light;
+}
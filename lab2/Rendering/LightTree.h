@@ -0,0 +1,44 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include "Rendering/Geometry.h"
+#include <vector>
+
+class Light;
+
+/*
+ * Binary hierarchy over the lights of a scene, used to pick a few lights per
+ * shading point out of hundreds. Every node knows the total power of the
+ * lights below it and a sphere around them. Sampling walks down from the
+ * root and at each node steps into a child with probability proportional to
+ * power / squared distance, so bright and nearby lights are picked most
+ * often. Nodes whose lights all have a range are skipped beyond their
+ * reach. The returned probability is exact, and dividing a light's
+ * contribution by it keeps the estimate unbiased. Every light with some
+ * power can be picked from anywhere it reaches.
+ */
+class LightTree {
+protected:
+	struct Node {
+		Pt3 center;
+		double radius; // sphere around center holding all lights of the node
+		double power;
+		double reach; // no light of the node reaches farther from center, DINF when unlimited
+		int left, right; // child nodes, -1 for leaves
+		int light; // light index of a leaf, -1 for inner nodes
+	};
+	std::vector<Node> _nodes;
+
+	int build(std::vector<int>& lights, int begin, int end, const std::vector<Light*>& all);
+	double importance(const Node& node, const Pt3& p) const;
+
+public:
+	void build(const std::vector<Light*>& lights);
+	bool empty() const { return _nodes.empty(); }
+
+	// Picks a light for point p with u in [0, 1); pdf is the probability of that pick.
+	// Returns -1 when no light with any power reaches p.
+	int sample(const Pt3& p, double u, double& pdf) const;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "Rendering/LiveRenderer.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+LiveRenderer::LiveRenderer(int threads) : _scene(NULL), _snapshot(NULL), _version(-1), _quit(false),
+	_frame(0), _top(RT_LIVE_COARSE), _coarse(RT_LIVE_COARSE), _stride(0), _nextBand(0), _bandsDone(0),
+	_busy(0), _complete(false), _firstTime(0), _fullTime(0) {
+	_tracer = new Raytracer();
+	if(threads <= 0)
+		threads = max(1, (int)thread::hardware_concurrency());
+	for(int k = 0; k < threads; k++)
+		_workers.push_back(thread(&LiveRenderer::work, this));
+}
+
+LiveRenderer::~LiveRenderer() {
+	stop();
+	{
+		lock_guard<mutex> lock(_mutex);
+		_quit = true;
+	}
+	_wake.notify_all();
+	for(size_t k = 0; k < _workers.size(); k++)
+		_workers[k].join();
+	delete _tracer;
+}
+
+bool LiveRenderer::update(Scene* scene, GLdouble modelview[16], GLdouble proj[16], GLint view[4]) {
+	vector<double> state(modelview, modelview+16);
+	state.insert(state.end(), proj, proj+16);
+	state.insert(state.end(), view, view+4);
+	if(scene == _scene && scene->getVersion() == _version && state == _view)
+		return false;
+
+	{
+		// The first pass of the frame in progress gets its time before it is replaced;
+		// when it can't make it in time the next frames start coarser
+		lock_guard<mutex> lock(_mutex);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - _begin).count();
+		if(_scene == scene && _stride > 0 && _stride == _top) {
+			if(seconds < RT_LIVE_FRAME_TIME)
+				return false;
+			if(_coarse < RT_LIVE_MAX_COARSE)
+				_coarse *= 2;
+		}
+	}
+
+	pause();
+	unique_lock<mutex> lock(_mutex);
+	_begin = chrono::steady_clock::now();
+	if(_snapshot)
+		Scene::release(_snapshot);
+	_scene = scene;
+	_version = scene->getVersion();
+	_view = state;
+	_snapshot = scene->snapshot();
+	_tracer->setScene(_snapshot);
+
+	// The new frame is traced over the last one, which stays visible until the passes
+	// reach it; the image of a new size starts black
+	_tracer->drawInit(modelview, proj, view);
+
+	_top = _stride = _coarse;
+	_nextBand = _bandsDone = 0;
+	_complete = false;
+	_wake.notify_all();
+	return true;
+}
+
+void LiveRenderer::stop() {
+	pause();
+	lock_guard<mutex> lock(_mutex);
+	if(_snapshot)
+		Scene::release(_snapshot);
+	_snapshot = NULL;
+	_scene = NULL;
+	_tracer->setScene(NULL);
+}
+
+// Hands out no more rows, and waits until the workers left the rows they were tracing
+void LiveRenderer::pause() {
+	unique_lock<mutex> lock(_mutex);
+	_stride = 0;
+	_frame++;
+	_idle.wait(lock, [this] { return _busy == 0; });
+}
+
+void LiveRenderer::work() {
+	unique_lock<mutex> lock(_mutex);
+	while(true) {
+		_wake.wait(lock, [this] { return _quit || (_stride > 0 && _nextBand < bands()); });
+		if(_quit) return;
+
+		int band = _nextBand++;
+		int stride = _stride;
+		int frame = _frame;
+		_busy++;
+		lock.unlock();
+		bool traced = traceBand(band, stride, frame);
+		lock.lock();
+		_busy--;
+		if(traced && frame == _frame && ++_bandsDone == bands())
+			finishPass();
+		if(_busy == 0)
+			_idle.notify_all();
+	}
+}
+
+/*
+ * Traces the pixels of the band on the pass's grid that coarser passes
+ * didn't trace, each filling the block it stands for; false when the frame
+ * was dropped halfway.
+ */
+bool LiveRenderer::traceBand(int band, int stride, int frame) {
+	int width = _tracer->getWidth(), height = _tracer->getHeight();
+	int rows = bandRows(stride);
+	for(int y = band*rows; y < (band+1)*rows && y < height; y += stride) {
+		for(int x = 0; x < width; x += stride) {
+			if(_frame != frame) return false;
+			if(stride < _top && x % (stride*2) == 0 && y % (stride*2) == 0)
+				continue;
+
+			_tracer->drawPixel(x, y);
+			if(stride == 1) continue;
+			Color color = _tracer->getPixel(x, y);
+			for(int j = y; j < y+stride && j < height; j++)
+				for(int i = x; i < x+stride && i < width; i++)
+					_tracer->setPixel(i, j, color);
+		}
+	}
+	return true;
+}
+
+// Called with the lock held once every band of the pass is traced
+void LiveRenderer::finishPass() {
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - _begin).count();
+	if(_stride == _top) {
+		_firstTime = seconds;
+		// A pass at half the spacing traces about four times the pixels
+		if(seconds > RT_LIVE_FRAME_TIME && _coarse < RT_LIVE_MAX_COARSE)
+			_coarse *= 2;
+		else if(seconds < RT_LIVE_FRAME_TIME/4 && _coarse > RT_LIVE_MIN_COARSE)
+			_coarse /= 2;
+	}
+
+	if(_stride == 1) {
+		_fullTime = seconds;
+		_stride = 0;
+		_complete = true;
+		return;
+	}
+	_stride /= 2;
+	_nextBand = _bandsDone = 0;
+	_wake.notify_all();
+}
+
+bool LiveRenderer::isComplete() {
+	lock_guard<mutex> lock(_mutex);
+	return _complete;
+}
+
+void LiveRenderer::printStats() {
+	lock_guard<mutex> lock(_mutex);
+	cout << "Live view (" << _workers.size() << " threads): 1/" << _top*_top << " of the pixels after "
+		<< _firstTime*1000 << " ms, all after " << _fullTime*1000 << " ms" << endl;
+}
@@ -0,0 +1,89 @@
+#ifndef LIVE_RENDERER_H
+#define LIVE_RENDERER_H
+
+#include "Rendering/Raytracer.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+// Pixel spacing of the first pass of a frame: starts at RT_LIVE_COARSE and
+// adapts so that the first pass takes about RT_LIVE_FRAME_TIME seconds
+#define RT_LIVE_COARSE 4
+#define RT_LIVE_MIN_COARSE 1
+#define RT_LIVE_MAX_COARSE 16
+#define RT_LIVE_FRAME_TIME (1.0/30)
+
+/*
+ * Ray-traced viewport that follows the camera. Every change of the view or
+ * the scene starts a new frame, traced coarse to fine like progressive
+ * mode: the first pass traces one pixel of every block and fills the block
+ * with it, each later pass halves the spacing, and the last one traces the
+ * remaining pixels, each frame over the image of the last. While the camera
+ * moves, a new frame replaces the one in progress as soon as that one
+ * finished its first pass or had RT_LIVE_FRAME_TIME for it; once the camera
+ * rests the image refines to full resolution. When the first pass takes
+ * longer than RT_LIVE_FRAME_TIME, the next frames start coarser, and finer
+ * when it is much faster.
+ *
+ * Passes are split into bands as high as the framebuffer's tiles, or one
+ * row of blocks when the blocks are larger, which a pool of worker threads,
+ * one per core, takes in turn. Every tile is written by one thread only, so
+ * threads don't share cache lines. Frames trace a snapshot of the scene, so
+ * it can be edited meanwhile, with a tracer of their own and its default
+ * settings.
+ */
+class LiveRenderer {
+protected:
+	Raytracer* _tracer;
+	Scene* _scene;
+	Scene* _snapshot;
+	int _version;
+	std::vector<double> _view; // modelview, projection and viewport of the frame
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake, _idle;
+	bool _quit;
+	std::atomic<int> _frame; // changes when the frame in progress is dropped
+	int _top; // spacing of the frame's first pass
+	int _coarse; // spacing of the next frame's first pass
+	int _stride; // spacing of the pass in progress, 0 when there is none
+	int _nextBand, _bandsDone, _busy;
+	bool _complete;
+	std::chrono::steady_clock::time_point _begin;
+	double _firstTime, _fullTime;
+
+	void work();
+	void pause();
+	// Image rows per band of a pass with the given spacing
+	static int bandRows(int stride) { return max(stride, FB_TILE); }
+	int bands() { return (_tracer->getHeight() + bandRows(_stride) - 1) / bandRows(_stride); }
+	bool traceBand(int band, int stride, int frame);
+	void finishPass();
+
+public:
+	// threads <= 0 starts one worker per core
+	LiveRenderer(int threads = 0);
+	~LiveRenderer();
+
+	// Starts a new frame when the view or the scene changed since the last
+	// one; returns true when it did
+	bool update(Scene* scene, GLdouble modelview[16], GLdouble proj[16], GLint view[4]);
+	// Drops the frame and lets go of the scene
+	void stop();
+
+	// Has a frame, whose image the workers write while it is drawn
+	bool hasFrame() { return _scene != NULL; }
+	Raytracer* getRaytracer() { return _tracer; }
+	int getWidth() { return _tracer->getWidth(); }
+	int getHeight() { return _tracer->getHeight(); }
+	int getThreads() { return (int)_workers.size(); }
+	// Every pixel of the frame is traced
+	bool isComplete();
+	void printStats();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "Rendering/OccluderMap.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+vector<Vec3> OccluderMap::_cellDirs;
+vector<double> OccluderMap::_cellAngles;
+
+// Direction through point (u, v) of the given face, u and v in [-1, 1]
+static Vec3 faceDir(int face, double u, double v) {
+	int axis = face / 2;
+	Vec3 dir(0, 0, 0, 0);
+	dir[axis] = (face % 2) ? -1 : 1;
+	dir[(axis+1) % 3] = u;
+	dir[(axis+2) % 3] = v;
+	dir.normalize();
+	return dir;
+}
+
+static double angleBetween(const Vec3& a, const Vec3& b) {
+	double d = a*b;
+	return acos(d > 1 ? 1 : (d < -1 ? -1 : d));
+}
+
+void OccluderMap::initCells() {
+	if(!_cellDirs.empty()) return;
+
+	const int n = RT_OCCLUDER_CELLS;
+	_cellDirs.resize(6*n*n);
+	_cellAngles.resize(6*n*n);
+	for(int face = 0; face < 6; face++) {
+		for(int j = 0; j < n; j++) {
+			for(int i = 0; i < n; i++) {
+				int cell = (face*n + j)*n + i;
+				double u0 = -1 + 2.*i/n, u1 = -1 + 2.*(i+1)/n;
+				double v0 = -1 + 2.*j/n, v1 = -1 + 2.*(j+1)/n;
+				_cellDirs[cell] = faceDir(face, (u0+u1)/2, (v0+v1)/2);
+
+				// The corners are the directions farthest from the center
+				double angle = 0;
+				angle = max(angle, angleBetween(_cellDirs[cell], faceDir(face, u0, v0)));
+				angle = max(angle, angleBetween(_cellDirs[cell], faceDir(face, u1, v0)));
+				angle = max(angle, angleBetween(_cellDirs[cell], faceDir(face, u0, v1)));
+				angle = max(angle, angleBetween(_cellDirs[cell], faceDir(face, u1, v1)));
+				_cellAngles[cell] = angle;
+			}
+		}
+	}
+}
+
+OccluderMap::OccluderMap() : _light(0, 0, 0), _radius(0) {
+	initCells();
+}
+
+int OccluderMap::cellIndex(const Vec3& dir) {
+	int axis = 0;
+	for(int i = 1; i < 3; i++)
+		if(fabs(dir[i]) > fabs(dir[axis])) axis = i;
+
+	double len = fabs(dir[axis]);
+	if(len == 0) return 0;
+
+	const int n = RT_OCCLUDER_CELLS;
+	int face = axis*2 + (dir[axis] < 0 ? 1 : 0);
+	int i = (int)((dir[(axis+1) % 3]/len + 1)/2 * n);
+	int j = (int)((dir[(axis+2) % 3]/len + 1)/2 * n);
+	i = i < 0 ? 0 : (i >= n ? n-1 : i);
+	j = j < 0 ? 0 : (j >= n ? n-1 : j);
+	return (face*n + j)*n + i;
+}
+
+bool OccluderMap::reaches(int cell, const BoundingBox& box) const {
+	if(box.empty()) return false;
+
+	Vec3 toCenter = box.center() - _light;
+	double d = mag(toCenter);
+	double r = box.radius() + _radius;
+
+	// Shadow rays start EPS off the surface and run dlight from there, so they
+	// overshoot the light by EPS; anything that close surrounds the light
+	if(d <= r + 10*EPS) return true;
+
+	toCenter.normalize();
+	double objectAngle = asin(r/d);
+	return angleBetween(_cellDirs[cell], toCenter) <= _cellAngles[cell] + objectAngle + 1e-6;
+}
+
+void OccluderMap::build(const Pt3& light, double radius, const vector<BoundingBox>& bounds) {
+	_light = light;
+	_radius = radius;
+	_cells.assign(_cellDirs.size(), vector<int>());
+	for(int j = 0; j < (int)bounds.size(); j++)
+		for(int cell = 0; cell < (int)_cells.size(); cell++)
+			if(reaches(cell, bounds[j]))
+				_cells[cell].push_back(j);
+}
+
+void OccluderMap::update(int object, const BoundingBox& box) {
+	for(int cell = 0; cell < (int)_cells.size(); cell++) {
+		vector<int>& list = _cells[cell];
+		vector<int>::iterator it = lower_bound(list.begin(), list.end(), object);
+		bool filed = (it != list.end() && *it == object);
+		bool reach = reaches(cell, box);
+		if(filed && !reach)
+			list.erase(it);
+		else if(!filed && reach)
+			list.insert(it, object);
+	}
+}
+
+const vector<int>* OccluderMap::candidates(const Pt3& p) const {
+	if(_cells.empty()) return NULL;
+	return &_cells[cellIndex(p - _light)];
+}
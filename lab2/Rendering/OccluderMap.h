@@ -0,0 +1,48 @@
+#ifndef OCCLUDER_MAP_H
+#define OCCLUDER_MAP_H
+
+#include "Rendering/Geometry.h"
+#include <vector>
+
+// Cells along each edge of a cube map face
+#define RT_OCCLUDER_CELLS 8
+
+/*
+ * Shadow ray candidates for one light. The directions around the light
+ * are split into the cells of a cube map; every cell lists the objects whose
+ * bounding sphere reaches into the cone of directions covered by that cell.
+ * A shadow ray from p toward the light can only be blocked by the objects
+ * filed under the direction from the light to p. Lists are kept in scene
+ * order so the shadow products come out exactly as with the full list.
+ * For area lights every bounding sphere is grown by the light's extent: a
+ * ray from p to any point of the light stays within that distance of the
+ * ray from p to the light's center, so the cell of p still lists it.
+ */
+class OccluderMap {
+protected:
+	Pt3 _light;
+	double _radius; // extent of the light, 0 for point lights
+	std::vector<std::vector<int> > _cells;
+
+	// Unit center direction and cone half-angle of each cell, shared by all maps
+	static std::vector<Vec3> _cellDirs;
+	static std::vector<double> _cellAngles;
+	static void initCells();
+
+	bool reaches(int cell, const BoundingBox& box) const;
+
+public:
+	OccluderMap();
+
+	void build(const Pt3& light, double radius, const std::vector<BoundingBox>& bounds);
+	// Re-files one object after its bounds changed
+	void update(int object, const BoundingBox& box);
+
+	const Pt3& getLight() const { return _light; }
+	double getRadius() const { return _radius; }
+	const std::vector<int>* candidates(const Pt3& p) const;
+
+	static int cellIndex(const Vec3& dir);
+};
+
+#endif
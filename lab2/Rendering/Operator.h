@@ -37,6 +37,8 @@ public:
 		_dirz = Vec3(0, 0, OP_STEP, 0);
 	}
 
+	virtual Geometry* clone() const { return new Operator(*this); }
+
 	virtual void accept(GeometryVisitor* visitor, void* ret) {
 		visitor->visit(this, ret);
 	}
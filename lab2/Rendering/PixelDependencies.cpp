@@ -0,0 +1,131 @@
+#include "Rendering/PixelDependencies.h"
+#include "Common/Common.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+PixelDependencies::PixelDependencies() : _width(0), _height(0) {
+	for(int i = 0; i < 3; i++)
+		for(int k = 0; k <= RT_DEP_GRID; k++)
+			_edges[i][k] = 0;
+}
+
+void PixelDependencies::reset(const BoundingBox& box, const vector<BoundingBox>& objects, int width, int height) {
+	_box = box;
+	_width = width;
+	_height = height;
+	for(int i = 0; i < 3; i++) {
+		vector<double> coords;
+		for(int j = 0; j < (int)objects.size(); j++) {
+			if(objects[j].empty()) continue;
+			coords.push_back(objects[j].min[i]);
+			coords.push_back(objects[j].max[i]);
+		}
+		sort(coords.begin(), coords.end());
+		coords.erase(unique(coords.begin(), coords.end()), coords.end());
+
+		// The outer cells reach from the objects to the grid bounds, inner
+		// edges are taken from the object bounds, and cells still missing
+		// come from halving the widest cell
+		vector<double> edges(1, box.min[i]);
+		if(coords.size() >= 2) {
+			int inner = RT_DEP_GRID-3, n = (int)coords.size()-2;
+			edges.push_back(coords.front());
+			for(int k = 1; k <= min(inner, n); k++)
+				edges.push_back(coords[n <= inner ? k : (k*(n+1))/(inner+1)]);
+			edges.push_back(coords.back());
+		}
+		edges.push_back(box.max[i]);
+		while((int)edges.size() < RT_DEP_GRID+1) {
+			int widest = 0;
+			for(int k = 1; k+1 < (int)edges.size(); k++)
+				if(edges[k+1] - edges[k] > edges[widest+1] - edges[widest]) widest = k;
+			edges.insert(edges.begin() + widest+1, 0.5*(edges[widest] + edges[widest+1]));
+		}
+		for(int k = 0; k <= RT_DEP_GRID; k++)
+			_edges[i][k] = edges[k];
+	}
+	_masks.assign(width*height, CellMask());
+}
+
+int PixelDependencies::cellOf(int axis, double v) const {
+	int cell = (int)(upper_bound(_edges[axis], _edges[axis] + RT_DEP_GRID+1, v) - _edges[axis]) - 1;
+	return cell < 0 ? 0 : (cell >= RT_DEP_GRID ? RT_DEP_GRID-1 : cell);
+}
+
+/*
+ * The segment is clipped to the grid and then walked cell by cell
+ * (Amanatides and Woo), setting the bit of every cell it enters.
+ */
+void PixelDependencies::record(int pixel, const Pt3& p, const Vec3& dir, double tmax) {
+	double t0 = 0, t1 = tmax;
+	for(int i = 0; i < 3; i++) {
+		if(fabs(dir[i]) < 1e-12) {
+			if(p[i] < _box.min[i] || p[i] > _box.max[i]) return;
+			continue;
+		}
+		double ta = (_box.min[i] - p[i]) / dir[i];
+		double tb = (_box.max[i] - p[i]) / dir[i];
+		if(ta > tb) swap(ta, tb);
+		t0 = max(t0, ta);
+		t1 = min(t1, tb);
+	}
+	if(t0 > t1) return;
+
+	int cell[3], step[3];
+	double next[3];
+	for(int i = 0; i < 3; i++) {
+		cell[i] = cellOf(i, p[i] + dir[i]*t0);
+		if(fabs(dir[i]) < 1e-12) {
+			step[i] = 0;
+			next[i] = DINF;
+			continue;
+		}
+		step[i] = dir[i] > 0 ? 1 : -1;
+		next[i] = (_edges[i][cell[i] + (dir[i] > 0 ? 1 : 0)] - p[i]) / dir[i];
+	}
+
+	CellMask& mask = _masks[pixel];
+	while(true) {
+		int bit = (cell[2]*RT_DEP_GRID + cell[1])*RT_DEP_GRID + cell[0];
+		mask.bits[bit >> 6] |= 1ULL << (bit & 63);
+
+		int axis = 0;
+		if(next[1] < next[axis]) axis = 1;
+		if(next[2] < next[axis]) axis = 2;
+		if(next[axis] > t1) break;
+		cell[axis] += step[axis];
+		if(cell[axis] < 0 || cell[axis] >= RT_DEP_GRID) break;
+		next[axis] = (_edges[axis][cell[axis] + (step[axis] > 0 ? 1 : 0)] - p[axis]) / dir[axis];
+	}
+}
+
+bool PixelDependencies::cellsOf(const BoundingBox& box, CellMask& mask) const {
+	mask.clear();
+	if(box.empty()) return true;
+
+	int lo[3], hi[3];
+	for(int i = 0; i < 3; i++) {
+		if(box.min[i] < _box.min[i] || box.max[i] > _box.max[i]) return false;
+		// Cells overlapping the bounds; a bound lying on a cell edge doesn't reach into the cell beyond it
+		lo[i] = cellOf(i, box.min[i]);
+		hi[i] = (int)(lower_bound(_edges[i], _edges[i] + RT_DEP_GRID+1, box.max[i]) - _edges[i]) - 1;
+		hi[i] = hi[i] < lo[i] ? lo[i] : (hi[i] >= RT_DEP_GRID ? RT_DEP_GRID-1 : hi[i]);
+	}
+
+	for(int z = lo[2]; z <= hi[2]; z++)
+		for(int y = lo[1]; y <= hi[1]; y++)
+			for(int x = lo[0]; x <= hi[0]; x++) {
+				int bit = (z*RT_DEP_GRID + y)*RT_DEP_GRID + x;
+				mask.bits[bit >> 6] |= 1ULL << (bit & 63);
+			}
+	return true;
+}
+
+bool PixelDependencies::touches(int pixel, const CellMask& mask) const {
+	const CellMask& m = _masks[pixel];
+	for(int i = 0; i < RT_DEP_WORDS; i++)
+		if(m.bits[i] & mask.bits[i]) return true;
+	return false;
+}
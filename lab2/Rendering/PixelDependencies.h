@@ -0,0 +1,65 @@
+#ifndef PIXEL_DEPENDENCIES_H
+#define PIXEL_DEPENDENCIES_H
+
+#include "Rendering/Geometry.h"
+#include <vector>
+
+// Cells along each axis of the dependency grid, and 64-bit words per pixel mask
+#define RT_DEP_GRID 8
+#define RT_DEP_WORDS (RT_DEP_GRID*RT_DEP_GRID*RT_DEP_GRID/64)
+
+// One bit per grid cell
+struct CellMask {
+	unsigned long long bits[RT_DEP_WORDS];
+	CellMask() { clear(); }
+	void clear() { for(int i = 0; i < RT_DEP_WORDS; i++) bits[i] = 0; }
+	void add(const CellMask& m) { for(int i = 0; i < RT_DEP_WORDS; i++) bits[i] |= m.bits[i]; }
+};
+
+/*
+ * Remembers, per pixel, which cells of a coarse grid over the scene the
+ * rays of its ray tree passed through: the primary ray, shadow rays and
+ * reflected and refracted rays, each up to where it stopped. A pixel can
+ * only change when an object it hit moves away or an object moves into one
+ * of its rays, and both happen inside the old or new bounds of that object.
+ * So after an edit only pixels touching the cells of those bounds have to be
+ * traced again. Parts of rays outside the grid aren't recorded; edits that
+ * reach outside the grid need a full frame.
+ *
+ * Cells aren't uniform: the outer cells along each axis cover the room
+ * around the objects, and the inner edges sit at quantiles of the object
+ * bounds, so the cells are small where objects are and an edit marks few
+ * rays that only pass near it.
+ */
+class PixelDependencies {
+protected:
+	BoundingBox _box;
+	double _edges[3][RT_DEP_GRID+1];
+	int _width;
+	int _height;
+	std::vector<CellMask> _masks;
+
+public:
+	PixelDependencies();
+
+	// Starts over with a grid over box, fitted to the objects' bounds, for a width x height image
+	void reset(const BoundingBox& box, const std::vector<BoundingBox>& objects, int width, int height);
+	bool valid() const { return !_masks.empty(); }
+	int getWidth() const { return _width; }
+	int getHeight() const { return _height; }
+	const BoundingBox& getBox() const { return _box; }
+
+	void clear(int pixel) { _masks[pixel].clear(); }
+	// Adds the segment p + t*dir, t in [0, tmax], to the pixel's cells
+	void record(int pixel, const Pt3& p, const Vec3& dir, double tmax);
+
+	// Cells overlapping box; false when box reaches outside the grid
+	bool cellsOf(const BoundingBox& box, CellMask& mask) const;
+	bool touches(int pixel, const CellMask& mask) const;
+
+protected:
+	// Cell along axis holding coordinate v, clamped to the grid
+	int cellOf(int axis, double v) const;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include "Rendering/RaySort.h"
+
+// Inserts two zero bits between each of the lower 10 bits of v
+unsigned int RaySorter::spreadBits(unsigned int v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+unsigned long long RaySorter::key(const Ray& ray) const {
+	unsigned int octant = (ray.dir[0] < 0 ? 1 : 0) | (ray.dir[1] < 0 ? 2 : 0) | (ray.dir[2] < 0 ? 4 : 0);
+
+	unsigned int cell[3] = { 0, 0, 0 };
+	if(!_bounds.empty()) {
+		for(int i = 0; i < 3; i++) {
+			double extent = _bounds.max[i] - _bounds.min[i];
+			double u = extent > 0 ? (ray.p[i] - _bounds.min[i]) / extent : 0;
+			u = u < 0 ? 0 : (u > 1 ? 1 : u); // origins outside the scene share the border cells
+			cell[i] = (unsigned int)(u * 1023);
+		}
+	}
+
+	unsigned int morton = spreadBits(cell[0]) | (spreadBits(cell[1]) << 1) | (spreadBits(cell[2]) << 2);
+	return ((unsigned long long)octant << 30) | morton;
+}
@@ -0,0 +1,41 @@
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include "Rendering/Geometry.h"
+#include <vector>
+#include <algorithm>
+
+/*
+ * Reorders batches of rays so that rays heading the same way from nearby
+ * origins are traced one after another. The sort key puts the direction
+ * octant in the top bits and a 30-bit Morton code of the origin, quantized
+ * inside the scene bounds, below it.
+ */
+class RaySorter {
+protected:
+	BoundingBox _bounds;
+	std::vector<std::pair<unsigned long long, int> > _keys;
+
+	static unsigned int spreadBits(unsigned int v);
+
+public:
+	void setBounds(const BoundingBox& bounds) { _bounds = bounds; }
+	unsigned long long key(const Ray& ray) const;
+
+	// Sorts any batch whose elements carry a Ray named "ray"
+	template <class T>
+	void sort(std::vector<T>& batch) {
+		_keys.resize(batch.size());
+		for(size_t k = 0; k < batch.size(); k++)
+			_keys[k] = std::make_pair(key(batch[k].ray), (int)k);
+		std::sort(_keys.begin(), _keys.end());
+
+		std::vector<T> sorted;
+		sorted.reserve(batch.size());
+		for(size_t k = 0; k < _keys.size(); k++)
+			sorted.push_back(batch[_keys[k].second]);
+		batch.swap(sorted);
+	}
+};
+
+#endif
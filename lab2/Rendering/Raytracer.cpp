@@ -1,18 +1,70 @@
 #include "Rendering/Raytracer.h"
+#include "Rendering/Wavefront.h"
+#include "Rendering/Antialias.h"
+#include "Rendering/Denoiser.h"
+#include "Rendering/Upsampler.h"
+#include "Rendering/Relighter.h"
 #include "Rendering/Shading.h"
+#include "Rendering/ImageWriter.h"
+#include "Rendering/HdrWriter.h"
 #include <FL/glu.h>
 #include "Common/Common.h"
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <iostream>
+
+using namespace std;
+
+// The cache a thread used last, valid while the generation matches
+struct ThreadShadowCache {
+	int generation;
+	ShadowCache* cache;
+};
+static thread_local ThreadShadowCache threadCache = { -1, NULL };
+static atomic<int> nextGeneration(0);
+// Image index of the pixel whose rays this thread traces, -1 when not recording,
+// and the relighting records of that pixel
+static thread_local int tracingPixel = -1;
+static thread_local std::vector<RelightNode>* relightNodes = NULL;
 
 Raytracer::Raytracer() {
-	_pixels = NULL;
+	_format = FB_RGBA_FLOAT;
+	_dirtyRows = NULL;
+	_width = _height = 0;
+	_bandY = _bandRows = 0;
+	_tilesX = _tilesY = 0;
+	_packetSize = RT_DEFAULT_PACKET;
+	_mode = RT_MODE_RECURSIVE;
+	_rasterPrimary = false;
+	_progressive = false;
+	_level = 0;
+	_rasterResolved = _rasterFallbacks = 0;
+	setAreaSamples(RT_AREA_SAMPLES);
+	_lightBudget = 0;
+	_incremental = _recording = _partial = _relit = false;
+	_stateScene = -1;
+	_wavefront = new WavefrontRenderer(this);
+	_antialiaser = new Antialiaser(this);
+	_denoiser = new Denoiser(this);
+	_upsampler = new Upsampler(this);
+	_relighter = new Relighter(this);
+	_generation = ++nextGeneration;
+}
+
+Raytracer::~Raytracer() {
+	clearShadowCaches();
+	delete _relighter;
+	delete _upsampler;
+	delete _denoiser;
+	delete _antialiaser;
+	delete _wavefront;
+	if(_dirtyRows) delete [] _dirtyRows;
 }
 
 void Raytracer::drawInit(GLdouble modelview[16], GLdouble proj[16], GLint view[4]) {
 	_width = view[2];
-	_height = view[3];
-
-	if(_pixels) delete [] _pixels;
-	_pixels = new float[_width*_height*4];
+	_height = _bandRows > 0 ? max(min(_bandRows, view[3] - _bandY), 0) : view[3];
 
 	memcpy(_modelview, modelview, 16*sizeof(modelview[0]));
 	memcpy(_proj, proj, 16*sizeof(proj[0]));
@@ -27,12 +79,325 @@ void Raytracer::drawInit(GLdouble modelview[16], GLdouble proj[16], GLint view[4
 	_final = mv*pr;
 	_invFinal = !_final;
 	_last = 0;
+	_level = 0;
+	_baseDone = false;
+	_denoised = false;
+	_wavefront->getStats().reset();
+
+	updateBounds();
+	updateTiles();
+	updateOccluderMaps();
+	updateLights();
+	clearShadowCaches();
+
+	_rasterResolved = _rasterFallbacks = 0;
+	if(_rasterPrimary)
+		updateIdBuffer();
+	_upsampler->begin();
+
+	// Partial and relit frames keep the previous image and guide buffers
+	planIncremental();
+	if(!_partial && !_relit) {
+		_image.resize(_width, _height, _format);
+		if(_dirtyRows) delete [] _dirtyRows;
+		_dirtyRows = new std::atomic<bool>[_height];
+		touchRows(0, _height);
+		_primaryIds.assign(_width*_height, -1);
+		_primaryNormals.assign(_width*_height*3, 0.f);
+		_primaryDepths.assign(_width*_height, 0.f);
+
+		_dependencies = PixelDependencies();
+		if(_recording && _incremental) {
+			// Room around the objects so that nudged objects stay inside the grid
+			BoundingBox box = _sceneBounds;
+			Vec3 size = box.max - box.min;
+			box.pad(0.5*max(size[0], max(size[1], size[2])) + EPS);
+			_dependencies.reset(box, _bounds, _width, _height);
+		}
+		// The wavefront renderer doesn't go through shade(), so it leaves no records
+		if(_recording && _relighter->getEnabled() && _mode != RT_MODE_WAVEFRONT)
+			_relighter->reset(_width, _height);
+		else
+			_relighter->invalidate();
+	}
+}
+
+std::vector<double> Raytracer::viewState() {
+	std::vector<double> state;
+	state.push_back(_width);
+	state.push_back(_height);
+	state.push_back(_bandY);
+	state.push_back(_format);
+	for(int j = 0; j < 16; j++) {
+		state.push_back(_modelview[j]);
+		state.push_back(_proj[j]);
+	}
+	state.push_back(_lightBudget);
+	state.push_back(_areaTable.getCount());
+	state.push_back(_scene->getNumObjects());
+	state.push_back(_scene->getNumLights());
+	return state;
+}
+
+// Values that shape the light's shadows come first, see sameShadows()
+#define RT_LIGHT_SHADOW_STATE 11
+
+std::vector<double> Raytracer::lightState(int i) {
+	std::vector<double> state;
+	Light* light = _scene->getLight(i);
+	for(int k = 0; k < 3; k++) {
+		state.push_back(light->getPos()[k]);
+		state.push_back(light->getEdgeU()[k]);
+		state.push_back(light->getEdgeV()[k]);
+	}
+	state.push_back(light->getShape());
+	state.push_back(light->getRadius());
+	for(int k = 0; k < 3; k++) {
+		state.push_back(light->getColor()[k]);
+		state.push_back(light->getAmbient()[k]);
+	}
+	state.push_back(light->getRange());
+	return state;
+}
+
+static bool sameShadows(const std::vector<double>& a, const std::vector<double>& b) {
+	return equal(a.begin(), a.begin() + RT_LIGHT_SHADOW_STATE, b.begin());
+}
+
+// Bounds and transformation of an object
+std::vector<double> Raytracer::objectState(int j) {
+	std::vector<double> state;
+	for(int k = 0; k < 3; k++) {
+		state.push_back(_bounds[j].min[k]);
+		state.push_back(_bounds[j].max[k]);
+	}
+	Mat4& mat = _scene->getObject(j)->getForwardMat();
+	for(int k = 0; k < 16; k++)
+		state.push_back(mat[k/4][k%4]);
+	return state;
+}
+
+std::vector<double> Raytracer::materialState(int j) {
+	std::vector<double> state;
+	Material* m = _scene->getMaterial(_scene->getObject(j));
+	for(int k = 0; k < 3; k++) {
+		state.push_back(m->getAmbient()[k]);
+		state.push_back(m->getDiffuse()[k]);
+		state.push_back(m->getSpecular()[k]);
+	}
+	state.push_back(m->getSpecExponent());
+	state.push_back(m->getReflective());
+	state.push_back(m->getTransparency());
+	state.push_back(m->getRefractIndex());
+	return state;
+}
+
+// Whether the materials trace the same rays: the same reflected rays, and
+// the same refracted rays and shadows through transparent objects
+static bool sameRays(const std::vector<double>& a, const std::vector<double>& b) {
+	return (a[10] > 0) == (b[10] > 0) && a[11] == b[11] && a[12] == b[12];
+}
+
+/*
+ * The previous image can be reused when the camera and the set of objects
+ * and lights are the same. When nothing moved and the materials trace the
+ * same rays, the relighter shades the recorded hits again. Otherwise, with
+ * the lights unchanged, only pixels whose rays passed through the old or new
+ * bounds of a changed object are retraced. Modes that mix pixels after
+ * tracing (anti-aliasing, denoising, upsampling, progressive levels) always
+ * render full frames.
+ */
+void Raytracer::planIncremental() {
+	_dirty.clear();
+	_partial = _relit = false;
+	_recording = (_incremental || _relighter->getEnabled()) && _scene && !_progressive
+		&& _antialiaser->getMaxDepth() == 0 && _denoiser->getIterations() == 0 && _upsampler->getReduction() == 1;
+	if(!_scene) return;
+
+	std::vector<double> view = viewState();
+	std::vector<std::vector<double> > lights(_scene->getNumLights());
+	for(int i = 0; i < (int)lights.size(); i++)
+		lights[i] = lightState(i);
+	std::vector<std::vector<double> > objects(_scene->getNumObjects()), materials(objects.size());
+	for(int j = 0; j < (int)objects.size(); j++) {
+		objects[j] = objectState(j);
+		materials[j] = materialState(j);
+	}
+
+	bool same = _recording && _stateScene == _scene->getLineage() && view == _viewState;
+	bool unchanged = same && lights == _lightStates && objects == _objectStates && materials == _materialStates;
+	bool relight = same && !unchanged && _relighter->valid() && objects == _objectStates;
+	for(int j = 0; j < (int)materials.size() && relight; j++)
+		relight = sameRays(materials[j], _materialStates[j]);
+
+	if(relight) {
+		std::vector<char> moved(lights.size());
+		for(int i = 0; i < (int)lights.size(); i++)
+			moved[i] = !sameShadows(lights[i], _lightStates[i]);
+		_relighter->begin(moved);
+		_relit = true;
+	}
+	else if(same && _incremental && _dependencies.valid() && lights == _lightStates) {
+		bool reuse = true;
+		CellMask edit;
+		for(int j = 0; j < (int)objects.size() && reuse; j++) {
+			if(objects[j] == _objectStates[j] && materials[j] == _materialStates[j]) continue;
+
+			const std::vector<double>& old = _objectStates[j];
+			BoundingBox oldBox(Pt3(old[0], old[2], old[4]), Pt3(old[1], old[3], old[5]));
+			CellMask cells;
+			reuse = _dependencies.cellsOf(oldBox, cells);
+			edit.add(cells);
+			reuse = reuse && _dependencies.cellsOf(_bounds[j], cells);
+			edit.add(cells);
+		}
+		// Gathered packet tile by packet tile, so drawDirty() can trace them as packets
+		for(int y0 = 0; y0 < _height && reuse; y0 += _packetSize)
+			for(int x0 = 0; x0 < _width; x0 += _packetSize)
+				for(int y = y0; y < y0+_packetSize && y < _height; y++)
+					for(int x = x0; x < x0+_packetSize && x < _width; x++)
+						if(_dependencies.touches(x + y*_width, edit))
+							_dirty.push_back(x + y*_width);
+		_partial = reuse;
+	}
+
+	_stateScene = _scene->getLineage();
+	_viewState = view;
+	_lightStates = lights;
+	_objectStates = objects;
+	_materialStates = materials;
+}
+
+/*
+ * The dirty pixels of one packet tile are traced together; drawPacket()
+ * culls with the whole tile's frustum and only the occluders of the
+ * retraced pixels' hits.
+ */
+bool Raytracer::drawDirty(int step) {
+	bool packets = _packetSize > 1 && _mode != RT_MODE_WAVEFRONT;
+	int j = _last;
+	while(j < (int)_dirty.size() && j < _last+step) {
+		int x0 = _dirty[j] % _width / _packetSize * _packetSize;
+		int y0 = _dirty[j] / _width / _packetSize * _packetSize;
+		int end = j;
+		while(end < (int)_dirty.size() && _dirty[end] % _width / _packetSize * _packetSize == x0
+				&& _dirty[end] / _width / _packetSize * _packetSize == y0)
+			end++;
+
+		for(int k = j; k < end; k++) {
+			_dependencies.clear(_dirty[k]);
+			if(_relighter->valid())
+				_relighter->nodes(_dirty[k]).clear();
+		}
+		if(packets)
+			drawPacket(x0, y0, &_dirty[j], end-j);
+		else
+			for(int k = j; k < end; k++)
+				drawPixel(_dirty[k] % _width, _dirty[k] / _width);
+		j = end;
+	}
+	_last = j;
+	return (_last >= (int)_dirty.size());
+}
+
+void Raytracer::setTracingPixel(int pixel) {
+	tracingPixel = _recording ? pixel : -1;
+	relightNodes = (pixel >= 0 && _relighter->valid()) ? &_relighter->nodes(pixel) : NULL;
+}
+
+void Raytracer::discardRecords() {
+	_viewState.clear();
+	_lightStates.clear();
+	_objectStates.clear();
+	_materialStates.clear();
+	_dependencies = PixelDependencies();
+	_relighter->invalidate();
+}
+
+void Raytracer::printIncrementalStats() {
+	if(!_recording) return;
+	if(_relit)
+		_relighter->printStats();
+	else if(_partial)
+		cout << "Incremental: retraced " << _dirty.size() << " of " << _width*_height << " pixels" << endl;
+	else
+		cout << "Incremental: full frame" << endl;
+}
+
+void Raytracer::updateLights() {
+	std::vector<Light*> lights;
+	for(int i = 0; _scene && i < _scene->getNumLights(); i++)
+		lights.push_back(_scene->getLight(i));
+	_lightTree.build(lights);
+	_lightGrid.build(lights);
+}
+
+void Raytracer::updateIdBuffer() {
+	TessellationVisitor tessellator;
+	std::vector<Pt3> triangles;
+	_idBuffer.begin(_final, _view);
+	for(int j = 0; _scene && j < _scene->getNumObjects(); j++) {
+		triangles.clear();
+		_scene->getObject(j)->accept(&tessellator, &triangles);
+		_idBuffer.draw(j, triangles);
+	}
+}
+
+void Raytracer::printPrimaryStats() {
+	if(!_rasterPrimary) return;
+	long long total = _rasterResolved + _rasterFallbacks;
+	cout << "Rasterized primary visibility: " << _rasterResolved << " of " << total
+		<< " pixels resolved from the ID buffer, " << _rasterFallbacks << " traced" << endl;
+}
+
+void Raytracer::clearShadowCaches() {
+	lock_guard<mutex> lock(_cacheMutex);
+	for(size_t k = 0; k < _shadowCaches.size(); k++)
+		delete _shadowCaches[k];
+	_shadowCaches.clear();
+	_generation = ++nextGeneration;
+}
+
+ShadowCache* Raytracer::shadowCache() {
+	if(threadCache.generation == _generation)
+		return threadCache.cache;
+
+	// First shadow ray of this thread in this frame (or it switched tracers)
+	lock_guard<mutex> lock(_cacheMutex);
+	thread::id self = this_thread::get_id();
+	ShadowCache* cache = NULL;
+	for(size_t k = 0; k < _shadowCaches.size() && !cache; k++)
+		if(_shadowCaches[k]->getOwner() == self)
+			cache = _shadowCaches[k];
+	if(!cache) {
+		cache = new ShadowCache(self, _scene->getNumLights());
+		_shadowCaches.push_back(cache);
+	}
+
+	threadCache.generation = _generation;
+	threadCache.cache = cache;
+	return cache;
+}
+
+ShadowCacheStats Raytracer::getShadowStats(int light) {
+	lock_guard<mutex> lock(_cacheMutex);
+	ShadowCacheStats total;
+	for(size_t k = 0; k < _shadowCaches.size(); k++)
+		if(light < _shadowCaches[k]->numLights())
+			total.add(_shadowCaches[k]->getStats(light));
+	return total;
+}
+
+void Raytracer::printShadowStats() {
+	int numLights = _scene ? _scene->getNumLights() : 0;
+	for(int i = 0; i < numLights; i++)
+		getShadowStats(i).print(i);
 }
 
 Pt3 Raytracer::unproject(const Pt3& p) {
 	Pt3	np = p;
-	np[0] = (p[0]-_view[0])/_view[2];
-	np[1] = (p[1]-_view[1])/_view[3];
+	np[0] = p[0]/_view[2];
+	np[1] = (p[1]+_bandY)/_view[3];
 
 	np[0] = np[0]*2-1;
 	np[1] = np[1]*2-1;
@@ -46,200 +411,845 @@ Pt3 Raytracer::unproject(const Pt3& p) {
 	return move(ret);
 }
 
+Ray Raytracer::primaryRay(double x, double y) {
+	Pt3 rst = unproject(Pt3(x, y, 0));
+	Pt3 red = unproject(Pt3(x, y, 1));
+
+	Ray r(rst, red-rst);
+	r.dir.normalize();
+	return r;
+}
+
+void Raytracer::updateBounds() {
+	BoundsVisitor visitor;
+	_bounds.resize(_scene ? _scene->getNumObjects() : 0);
+	_sceneBounds = BoundingBox();
+	for(int j = 0; j < (int)_bounds.size(); j++) {
+		_scene->getObject(j)->accept(&visitor, &_bounds[j]);
+		// Keeps the culling conservative against round-off in the exact tests
+		_bounds[j].pad(1e-4);
+		_sceneBounds.extend(_bounds[j]);
+	}
+}
+
+static bool sameBounds(const BoundingBox& a, const BoundingBox& b) {
+	for(int i = 0; i < 3; i++)
+		if(a.min[i] != b.min[i] || a.max[i] != b.max[i]) return false;
+	return true;
+}
+
+/*
+ * Occluder maps only change when something moves: a map is rebuilt when its
+ * light moved or changed size, and objects whose bounds changed are re-filed in the others.
+ * Adding or removing lights or objects starts over from scratch.
+ */
+void Raytracer::updateOccluderMaps() {
+	int numLights = _scene ? _scene->getNumLights() : 0;
+	bool rebuild = (int)_occluderMaps.size() != numLights || _mappedBounds.size() != _bounds.size();
+	if(rebuild)
+		_occluderMaps.assign(numLights, OccluderMap());
+
+	for(int i = 0; i < numLights; i++) {
+		OccluderMap& map = _occluderMaps[i];
+		const Pt3& pos = _scene->getLight(i)->getPos();
+		double radius = _scene->getLight(i)->getExtent();
+		bool moved = pos[0] != map.getLight()[0] || pos[1] != map.getLight()[1] || pos[2] != map.getLight()[2];
+		if(rebuild || moved || radius != map.getRadius()) {
+			map.build(pos, radius, _bounds);
+			continue;
+		}
+
+		for(int j = 0; j < (int)_bounds.size(); j++)
+			if(!sameBounds(_bounds[j], _mappedBounds[j]))
+				map.update(j, _bounds[j]);
+	}
+	_mappedBounds = _bounds;
+}
+
+/*
+ * Projects the corners of every object's bounds to the window and files the
+ * object under each tile its screen rectangle touches. Objects straddling the
+ * eye plane have no finite projection, so they go into every tile; objects
+ * entirely between the eye and the near plane can't be hit at all.
+ */
+void Raytracer::updateTiles() {
+	_tilesX = (_width + RT_CULL_TILE - 1) / RT_CULL_TILE;
+	_tilesY = (_height + RT_CULL_TILE - 1) / RT_CULL_TILE;
+	_tileObjects.assign(_tilesX*_tilesY, ObjectList());
+
+	for(int j = 0; j < (int)_bounds.size(); j++) {
+		const BoundingBox& box = _bounds[j];
+		double xmin = DINF, ymin = DINF, xmax = -DINF, ymax = -DINF;
+		bool behindNear = true, crossesEye = false;
+		for(int k = 0; k < 8; k++) {
+			Pt3 corner(k&1 ? box.max[0] : box.min[0], k&2 ? box.max[1] : box.min[1], k&4 ? box.max[2] : box.min[2]);
+			Pt3 clip = corner*_final;
+			if(clip[2] >= -clip[3]) behindNear = false;
+			if(clip[3] <= EPS) {
+				crossesEye = true;
+				continue;
+			}
+			double x = (clip[0]/clip[3] + 1)/2 * _view[2];
+			double y = (clip[1]/clip[3] + 1)/2 * _view[3];
+			xmin = min(xmin, x);
+			xmax = max(xmax, x);
+			ymin = min(ymin, y);
+			ymax = max(ymax, y);
+		}
+		if(behindNear) continue;
+
+		// Pixels are sampled at integer pixel coordinates, one pixel of slack for round-off
+		int px0 = 0, py0 = 0, px1 = _width-1, py1 = _height-1;
+		if(!crossesEye) {
+			px0 = max(px0, (int)floor(xmin) - 1);
+			py0 = max(py0, (int)floor(ymin) - 1 - _bandY);
+			px1 = min(px1, (int)ceil(xmax) + 1);
+			py1 = min(py1, (int)ceil(ymax) + 1 - _bandY);
+		}
+		if(px0 > px1 || py0 > py1) continue; // off screen
+
+		for(int ty = py0 / RT_CULL_TILE; ty <= py1 / RT_CULL_TILE; ty++)
+			for(int tx = px0 / RT_CULL_TILE; tx <= px1 / RT_CULL_TILE; tx++)
+				_tileObjects[tx + ty*_tilesX].push_back(j);
+	}
+}
+
+const ObjectList* Raytracer::primaryCandidates(int x, int y) {
+	if(_tileObjects.empty()) return NULL;
+	return &_tileObjects[x / RT_CULL_TILE + (y / RT_CULL_TILE)*_tilesX];
+}
+
+void Raytracer::primaryCandidates(int x0, int y0, int x1, int y1, ObjectList& out) {
+	out.clear();
+	if(_tileObjects.empty()) {
+		for(int j = 0; j < (int)_bounds.size(); j++)
+			out.push_back(j);
+		return;
+	}
+
+	// Every tile list is sorted by object index, so they merge in order
+	ObjectList merged;
+	for(int ty = y0 / RT_CULL_TILE; ty <= y1 / RT_CULL_TILE; ty++) {
+		for(int tx = x0 / RT_CULL_TILE; tx <= x1 / RT_CULL_TILE; tx++) {
+			const ObjectList& tile = _tileObjects[tx + ty*_tilesX];
+			merged.clear();
+			std::set_union(out.begin(), out.end(), tile.begin(), tile.end(), std::back_inserter(merged));
+			out.swap(merged);
+		}
+	}
+}
+
 bool Raytracer::draw(int step) {
-	int size = _width*_height;
+	if(!_baseDone) {
+		if(_relit)
+			_baseDone = _relighter->draw(step);
+		else if(_partial)
+			_baseDone = drawDirty(step);
+		else if(_progressive)
+			_baseDone = drawProgressive(step);
+		else if(_upsampler->getReduction() > 1 && _scene)
+			_baseDone = _upsampler->draw(step);
+		else
+			_baseDone = drawBase(step);
+		if(!_baseDone) return false;
+		_antialiaser->begin();
+	}
+	if(!_antialiaser->draw(step))
+		return false;
+
+	// The denoiser runs once, over the finished image
+	if(!_denoised) {
+		_denoiser->apply();
+		_denoised = true;
+	}
+	return true;
+}
 
-	int j;
-	for(j = _last; j < size && j < _last+step; j++) {
-		int x = j % _width;
-		int y = j / _width;
+bool Raytracer::drawBase(int step) {
+	if(_mode == RT_MODE_WAVEFRONT && _scene) {
+		// _last counts wavefront tiles, visited row by row
+		int tilesX = (_width + RT_WAVEFRONT_TILE - 1) / RT_WAVEFRONT_TILE;
+		int tilesY = (_height + RT_WAVEFRONT_TILE - 1) / RT_WAVEFRONT_TILE;
+		int tiles = tilesX*tilesY;
 
-		Pt3 rst = unproject(Pt3(x, y, 0));
-		Pt3 red = unproject(Pt3(x, y, 1));
+		int done = 0;
+		while(_last < tiles && done < step) {
+			int x0 = (_last % tilesX) * RT_WAVEFRONT_TILE;
+			int y0 = (_last / tilesX) * RT_WAVEFRONT_TILE;
+			int w = min(RT_WAVEFRONT_TILE, _width - x0);
+			int h = min(RT_WAVEFRONT_TILE, _height - y0);
+			_wavefront->drawTile(x0, y0, w, h);
+			done += w*h;
+			_last++;
+		}
+		return (_last >= tiles);
+	}
 
-		Ray r(rst, red-rst);
-		r.dir.normalize();
+	if(_packetSize <= 1) {
+		int size = _width*_height;
 
-		TraceResult res;
-		if(_scene)
-			res = trace(r, 0);
+		int j;
+		for(j = _last; j < size && j < _last+step; j++)
+			drawPixel(j % _width, j / _width);
 
-		res.color[3] = 1;
-		int offset = (x + y*_width) * 4;
-		for(int i = 0; i < 4; i++)
-			_pixels[offset + i] = res.color[i];
+		_last = j;
+		return (_last >= size);
 	}
 
-	_last = j;
-	return (_last >= size);
+	// Packet mode: _last counts packets, visited row by row
+	int tilesX = (_width + _packetSize - 1) / _packetSize;
+	int tilesY = (_height + _packetSize - 1) / _packetSize;
+	int tiles = tilesX*tilesY;
+
+	int done = 0;
+	while(_last < tiles && done < step) {
+		drawPacket((_last % tilesX) * _packetSize, (_last / tilesX) * _packetSize);
+		done += _packetSize*_packetSize;
+		_last++;
+	}
+	return (_last >= tiles);
 }
 
-TraceResult Raytracer::trace(const Ray& ray, int depth, double c) {
-	TraceResult res;
-	IsectData data;
-	Geometry* geom;
-	Material* mat;
+void Raytracer::setPixel(int x, int y, const Color& color) {
+	_image.set(x, y, color);
+	_dirtyRows[y].store(true, memory_order_release);
+}
 
-	if (depth > 5) {
+void Raytracer::touchRows(int y0, int y1) {
+	for(int y = max(y0, 0); y < y1 && y < _height; y++)
+		_dirtyRows[y].store(true, memory_order_release);
+}
+
+bool Raytracer::takeDirtyRows(int from, int& y0, int& y1) {
+	int y = max(from, 0);
+	while(y < _height && !_dirtyRows[y].exchange(false, memory_order_acquire))
+		y++;
+	if(y >= _height) return false;
+	y0 = y++;
+	while(y < _height && _dirtyRows[y].exchange(false, memory_order_acquire))
+		y++;
+	y1 = y;
+	return true;
+}
+
+bool Raytracer::saveImage(const std::string& fname, bool srgb, bool aovs, bool rle) {
+	if(HdrWriter::formatOf(fname) < 0)
+		return ImageWriter::save(fname, _image, srgb);
+	HdrAovs buffers;
+	if(aovs && !_primaryIds.empty()) {
+		buffers.depths = _primaryDepths.data();
+		buffers.normals = _primaryNormals.data();
+		buffers.ids = _primaryIds.data();
+	}
+	return HdrWriter::save(fname, _image, buffers, rle);
+}
+
+void Raytracer::drawPixel(int x, int y) {
+	TraceResult res;
+	Ray ray = primaryRay(x, y);
+	HitRecord hit;
+	setTracingPixel(x + y*_width);
+	if(_scene && primaryHit(x, y, ray, hit))
+		res = shade(ray, hit, 0, 1.0);
+	else
 		res.color = Color(0, 0, 0);
-		return res;
+	setTracingPixel(-1);
+
+	res.color[3] = 1;
+	setPixel(x, y, res.color);
+}
+
+/*
+ * Each level traces the pixels of a grid twice as fine as the previous one,
+ * skipping those the coarser grids already traced, and fills the block a
+ * pixel stands for with its color until finer levels overwrite it. The whole
+ * image is covered after the first level, which traces 1/16 of the pixels;
+ * _last walks the grid of the current level.
+ */
+bool Raytracer::drawProgressive(int step) {
+	int done = 0;
+	while(_level < RT_PROGRESSIVE_LEVELS && done < step) {
+		int stride = 1 << (RT_PROGRESSIVE_LEVELS-1 - _level);
+		int cols = (_width + stride - 1) / stride;
+		int rows = (_height + stride - 1) / stride;
+		if(_last >= cols*rows) {
+			_level++;
+			_last = 0;
+			continue;
+		}
+
+		int x = (_last % cols) * stride;
+		int y = (_last / cols) * stride;
+		_last++;
+		if(_level > 0 && x % (stride*2) == 0 && y % (stride*2) == 0)
+			continue;
+
+		drawPixel(x, y);
+		done++;
+
+		Color color = _image.get(x, y);
+		for(int j = y; j < y+stride && j < _height; j++)
+			for(int i = x; i < x+stride && i < _width; i++)
+				setPixel(i, j, color);
 	}
+	return (_level >= RT_PROGRESSIVE_LEVELS);
+}
 
-	const Color ambientI = _scene->getLight(0)->getAmbient();
-	double bestTime = DINF;
-	Material* bestMat = NULL;
-	Vec3 bestNormal;
-	Pt3 bestPoint;
+/*
+ * Traces a square packet of primary rays whose lower-left pixel is (x0, y0).
+ * The four corner rays bound a frustum, so objects of the packet's screen
+ * tiles whose bounding sphere lies outside of it can't be hit by any ray of
+ * the packet. Shadow rays toward one
+ * light from the packet's hit points all lie inside the box spanned by the
+ * light and those points, which culls the occluders the same way. Reflected
+ * and refracted rays diverge, so they fall back to single-ray tracing.
+ */
+void Raytracer::drawPacket(int x0, int y0, const int* pixels, int count) {
+	int x1 = min(x0+_packetSize, _width) - 1;
+	int y1 = min(y0+_packetSize, _height) - 1;
+	int nx = x1-x0+1;
+	int ny = y1-y0+1;
 
-	/* Find best intersection for this ray */
-	_intersector.setRay(ray);
-	for (int j = 0; j < _scene->getNumObjects(); j++) {
+	bool traced[RT_MAX_PACKET*RT_MAX_PACKET];
+	for(int k = 0; k < nx*ny; k++)
+		traced[k] = !pixels;
+	for(int k = 0; k < count; k++)
+		traced[pixels[k] % _width - x0 + (pixels[k] / _width - y0)*nx] = true;
+
+	if(!_scene) {
+		for(int k = 0; k < nx*ny; k++)
+			if(traced[k]) drawPixel(x0 + k%nx, y0 + k/nx);
+		return;
+	}
+
+	Ray rays[RT_MAX_PACKET*RT_MAX_PACKET];
+	HitRecord hits[RT_MAX_PACKET*RT_MAX_PACKET];
+	for(int y = 0; y < ny; y++)
+		for(int x = 0; x < nx; x++)
+			rays[x + y*nx] = primaryRay(x0+x, y0+y);
+
+	// Frustum side planes through consecutive corner rays, oriented toward the packet center
+	const Ray* corners[4] = { &rays[0], &rays[nx-1], &rays[nx*ny-1], &rays[(ny-1)*nx] };
+	Ray center = primaryRay((x0+x1)/2., (y0+y1)/2.);
+	Pt3 inside = center.p + center.dir;
+	Plane planes[4];
+	int numPlanes = 0;
+	for(int i = 0; i < 4; i++) {
+		const Ray& a = *corners[i];
+		const Ray& b = *corners[(i+1)%4];
+		Vec3 n = cross(a.dir, (b.p + b.dir) - a.p);
+		if(mag(n) < 1e-12) continue; // single row or column of rays
+		n.normalize();
+		if(n * (inside - a.p) < 0) n = -n;
+		planes[numPlanes++] = Plane(a.p, n);
+	}
+
+	ObjectList visible, candidates;
+	primaryCandidates(x0, y0, x1, y1, visible);
+	for(size_t k = 0; k < visible.size(); k++) {
+		int j = visible[k];
+		Pt3 c = _bounds[j].center();
+		double r = _bounds[j].radius();
+		bool inside = true;
+		for(int i = 0; i < numPlanes && inside; i++)
+			inside = planes[i].n * (c - planes[i].p) >= -r;
+		if(inside) candidates.push_back(j);
+	}
+
+	BoundingBox hitBox;
+	for(int k = 0; k < nx*ny; k++) {
+		if(!traced[k]) continue;
+		setTracingPixel(x0 + k%nx + (y0 + k/nx)*_width);
+		if(primaryHit(x0 + k%nx, y0 + k/nx, rays[k], hits[k], &candidates))
+			hitBox.extend(rays[k].at(hits[k].t));
+	}
+
+	std::vector<ObjectList> occluders(_scene->getNumLights());
+	if(!hitBox.empty()) {
+		for(int i = 0; i < _scene->getNumLights(); i++) {
+			Light* light = _scene->getLight(i);
+			Vec3 extent(light->getExtent(), light->getExtent(), light->getExtent(), 0);
+			BoundingBox shadowBox = hitBox;
+			shadowBox.extend(light->getPos() - extent);
+			shadowBox.extend(light->getPos() + extent);
+			for(int j = 0; j < (int)_bounds.size(); j++)
+				if(_bounds[j].overlaps(shadowBox))
+					occluders[i].push_back(j);
+		}
+	}
+
+	for(int y = 0; y < ny; y++) {
+		for(int x = 0; x < nx; x++) {
+			int k = x + y*nx;
+			if(!traced[k]) continue;
+			TraceResult res;
+			setTracingPixel(x0+x + (y0+y)*_width);
+			if(hits[k].object >= 0)
+				res = shade(rays[k], hits[k], 0, 1.0, occluders.data());
+			else
+				res.color = Color(0, 0, 0);
+			setTracingPixel(-1);
+
+			res.color[3] = 1;
+			setPixel(x0+x, y0+y, res.color);
+		}
+	}
+}
+
+bool Raytracer::primaryHit(int x, int y, const Ray& ray, HitRecord& hit, const ObjectList* fallback) {
+	bool found = findPrimaryHit(x, y, ray, hit, fallback);
+	int k = x + y*_width;
+	if(tracingPixel >= 0 && _incremental)
+		_dependencies.record(tracingPixel, ray.p, ray.dir, hit.t);
+	_primaryIds[k] = hit.object;
+	if(found) {
+		for(int i = 0; i < 3; i++)
+			_primaryNormals[k*3 + i] = (float)hit.normal[i];
+		_primaryDepths[k] = (float)hit.t;
+	}
+	return found;
+}
+
+/*
+ * With rasterized visibility the ID buffer names the visible object, which
+ * is then intersected exactly. The rasterized meshes contain their shapes,
+ * so the exact hit can only lie behind the rasterized depth; when it lies
+ * too far behind, misses, or the pixel sits on an edge between objects, the
+ * ray is traced against fallback like any other primary ray. So is a pixel
+ * where the closest other object's rasterized surface doesn't lie behind
+ * the exact hit: near touching objects its exact surface may be in front,
+ * even though its mesh was drawn behind.
+ */
+bool Raytracer::findPrimaryHit(int x, int y, const Ray& ray, HitRecord& hit, const ObjectList* fallback) {
+	if(_rasterPrimary && _idBuffer.isInterior(x, y)) {
+		int id = _idBuffer.getObject(x, y);
+		if(id < 0) {
+			_rasterResolved++;
+			return false;
+		}
+
+		ObjectList single(1, id);
+		HitRecord exact;
+		if(intersect(ray, exact, &single)) {
+			Pt3 p = unproject(Pt3(x, y, _idBuffer.getDepth(x, y)));
+			double t = (p - ray.p) * ray.dir;
+			bool occluded = false;
+			if(_idBuffer.getSecondObject(x, y) >= 0) {
+				Pt3 q = unproject(Pt3(x, y, _idBuffer.getSecondDepth(x, y)));
+				occluded = (q - ray.p) * ray.dir <= exact.t;
+			}
+			// Tessellation error grows with the size of the object
+			if(!occluded && fabs(exact.t - t) <= 0.02*_bounds[id].radius() + 1e-3) {
+				hit = exact;
+				_rasterResolved++;
+				return true;
+			}
+		}
+	}
+
+	if(_rasterPrimary)
+		_rasterFallbacks++;
+	return intersect(ray, hit, fallback ? fallback : primaryCandidates(x, y));
+}
+
+bool Raytracer::intersect(const Ray& ray, HitRecord& hit, const ObjectList* candidates) {
+	Intersector intersector;
+	IsectData data;
+
+	int n = candidates ? (int)candidates->size() : _scene->getNumObjects();
+	intersector.setRay(ray);
+	for (int k = 0; k < n; k++) {
+		int j = candidates ? (*candidates)[k] : k;
 		data.hit = false;
-		geom = _scene->getObject(j);
-		mat = _scene->getMaterial(geom);
-		geom->accept(&_intersector, &data);
+		_scene->getObject(j)->accept(&intersector, &data);
 
 		if (data.hit && data.t > EPS) {
-			if (bestTime > data.t) {
-				bestTime = data.t;
-				bestNormal = data.normal;
-				bestMat = mat;
+			if (hit.t > data.t) {
+				hit.t = data.t;
+				hit.normal = data.normal;
+				hit.object = j;
 			}
 		}
 	}
 
-	Pt3 hitPoint;
-	if (bestTime < DINF) { // hit
-		const Color ambientK = bestMat->getAmbient();
-		const Color diffuseK = bestMat->getDiffuse();
-		const Color specularK = bestMat->getSpecular();
-		const double reflectivity = bestMat->getReflective();
-		const double transparency = bestMat->getTransparency();
-		const double refractIndex = c == 1 ? bestMat->getRefractIndex() : 1;
-		const double specExponent = bestMat->getSpecExponent();
+	if (tracingPixel >= 0 && _incremental)
+		_dependencies.record(tracingPixel, ray.p, ray.dir, hit.t);
 
-		// P2V is a unit vector from hitPoint to viewer
-		hitPoint = ray.at(bestTime);
-		Vec3 P2V = ray.p - hitPoint;
-		P2V.normalize();
+	if (hit.object < 0)
+		return false;
+	hit.mat = _scene->getMaterial(_scene->getObject(hit.object));
+	return true;
+}
 
-		// Ambient Intensity = kaIa
-		res.color[0] = ambientI[0] * ambientK[0];
-		res.color[1] = ambientI[1] * ambientK[1];
-		res.color[2] = ambientI[2] * ambientK[2];
+/*
+ * Any opaque occluder settles the query at 0, so the opaque objects that
+ * blocked this light most recently are tried first, and the full loop stops
+ * as soon as the product reaches 0. Transparent occluders are multiplied in
+ * in scene order, exactly as when every object is tested.
+ */
+double Raytracer::shadow(const Ray& ray, double dlight, const ObjectList* candidates, int light) {
+	Intersector intersector;
+	IsectData data;
+	double shadow = 1.0;
+	intersector.setRay(ray);
+	// A blocked ray depends only on the part up to its blocker
+	bool record = tracingPixel >= 0 && _incremental;
 
-		for (int i = 0; i < _scene->getNumLights(); i++) {
-			Light* light = _scene->getLight(i);
-			Color colorLight = light->getColor();
-
-			// P2L is a unit vector from light to hitPoint
-			Vec3 P2L = light->getPos() - hitPoint;
-			double dlight = sqrt(P2L * P2L);
-			P2L.normalize();
-
-			Color diffuseI = Color(0, 0, 0);
-			Color specularI = Color(0, 0, 0);
-			double shadow = 1.0;
-
-			/* If (L•N) is 0 or negative, the light has not effect on diffuse or specular */
-			double LXN = P2L * bestNormal;
-			if (LXN > 0) {
-				// Diffuse Reflection = Kd (L•N) Ip
-				// L = Point of Intersection to Light source
-				// pointLight refers to the color of the light
-				diffuseI = Color(
-					diffuseK[0] * LXN * colorLight[0],
-					diffuseK[1] * LXN * colorLight[1],
-					diffuseK[2] * LXN * colorLight[2]
-				);
-
-				// Specular Reflection = Ks (R•V)^n Ip
-				// V = Point on the surface to the viewer
-				Vec3 R = 2 * LXN * bestNormal - P2L;
-				double RXVN = pow(R * P2V, specExponent);
-				specularI = Color(
-					specularK[0] * RXVN * colorLight[0],
-					specularK[1] * RXVN * colorLight[1],
-					specularK[2] * RXVN * colorLight[2]
-				);
-
-				Pt3 hitPoint1 = hitPoint + P2L * EPS;
-				Ray surfaceRay = Ray(hitPoint1, P2L);
-				_intersector.setRay(surfaceRay);
-
-				for (int j = 0; j < _scene->getNumObjects(); j++) {
-					data.hit = false;
-					geom = _scene->getObject(j);
-					geom->accept(&_intersector, &data);
-
-					if (data.hit && data.t > 0.0001) {
-						Pt3 newHitPoint = surfaceRay.at(data.t);
-						if (abs(data.t) < dlight) {
-							mat = _scene->getMaterial(geom);
-							shadow = mat->getTransparency() * shadow;
-						}
-					}
-				}
+	ShadowCache* cache = light >= 0 ? shadowCache() : NULL;
+	ShadowCacheStats* stats = cache ? &cache->getStats(light) : NULL;
+	if (stats) {
+		stats->queries++;
+		const int* recent = cache->recent(light);
+		for (int k = 0; k < RT_SHADOW_CACHE_SIZE && recent[k] >= 0; k++) {
+			int j = recent[k];
+			if (candidates && !binary_search(candidates->begin(), candidates->end(), j))
+				continue; // culled for this ray, can't block it
+			data.hit = false;
+			_scene->getObject(j)->accept(&intersector, &data);
+			stats->tests++;
 
-				res.color[0] += shadow * (diffuseI[0] + specularI[0]);
-				res.color[1] += shadow * (diffuseI[1] + specularI[1]);
-				res.color[2] += shadow * (diffuseI[2] + specularI[2]);
+			if (data.hit && data.t > 0.0001 && abs(data.t) < dlight) {
+				cache->promote(light, j);
+				stats->cacheHits++;
+				if (record) _dependencies.record(tracingPixel, ray.p, ray.dir, data.t);
+				return 0;
 			}
 		}
+	}
+
+	int n = candidates ? (int)candidates->size() : _scene->getNumObjects();
+	for (int k = 0; k < n; k++) {
+		int j = candidates ? (*candidates)[k] : k;
+		if (cache && cache->isRecent(light, j))
+			continue; // already missed above
 
-		Color reflect = Color(0, 0, 0);
-		Color refract = Color(0, 0, 0);
-
-		// Reflection Itensity = ksIreflected
-		// Reflected Vector W = 2(V•N)N - V
-		if (reflectivity > 0) {
-			Vec3 W = 2 * (P2V * bestNormal) * bestNormal - P2V;
-			W.normalize();
-			reflect = trace(Ray(hitPoint, W), depth + 1).color;
-		}
-
-		if (transparency > 0) {
-			// Total Reflection Check
-			// (N•V)^2 + (c1 / c2)^2 < 1
-			// c1 = index of refraction from outside
-			// c2 = index of refraction of material
-			double c1 = c;
-			double c2 = refractIndex;
-			double NXV = bestNormal * P2V;
-			double NXV2 = NXV * NXV;
-			double totalReflection = NXV2 + (c1 / c2) * (c1 / c2);
-			if (totalReflection >= 1) {
-				/*
-				 * If NXV < 0, it's crossing face from inside to outside.
-				 * If you don't flip normal here, this ray is trapped inside.
-				 */
-				Vec3 refractNormal = bestNormal;
-				if (NXV < 0) refractNormal = -bestNormal;
-
-				/*
-				 * cos(Θ₂) = sqrt(1 - (c2 / c1)^2 (1 - (N•V)^2))
-				 * W = ((c2/c1)(N•V) - cos(Θ₂))N - (c2/c1)V
-				 */
-				double refractRatio = c2 / c1;
-				double cosin = sqrt(1 - (refractRatio * refractRatio) * (1 - NXV2));
-				Vec3 W = (refractRatio * (refractNormal * P2V) - cosin) * refractNormal - refractRatio * P2V;
-				W.normalize();
-
-				if (c == 1) // If currently in air traveling into material
-					refract = trace(Ray(hitPoint, W), depth + 1, bestMat->getRefractIndex()).color;
-				else // If currently in material and coming out into air
-					refract = trace(Ray(hitPoint, W), depth + 1, 1.0).color;
+		Geometry* geom = _scene->getObject(j);
+		data.hit = false;
+		geom->accept(&intersector, &data);
+		if (stats) stats->tests++;
+
+		if (data.hit && data.t > 0.0001) {
+			if (abs(data.t) < dlight) {
+				double transparency = _scene->getMaterial(geom)->getTransparency();
+				shadow = transparency * shadow;
+				if (shadow == 0) {
+					if (cache) {
+						if (transparency == 0) cache->promote(light, j);
+						stats->earlyExits++;
+					}
+					if (record) _dependencies.record(tracingPixel, ray.p, ray.dir, data.t);
+					return 0;
+				}
 			}
 		}
+	}
+	if (record) _dependencies.record(tracingPixel, ray.p, ray.dir, dlight);
+	return shadow;
+}
+
+// Hash of the point quantized to 1/4096, seeds the per-point sampling decisions
+static unsigned int pointHash(const Pt3& p) {
+	unsigned int h = 0;
+	for (int k = 0; k < 3; k++)
+		h = (h ^ (unsigned int)(long long)floor(p[k] * 4096)) * 0x9E3779B1u;
+	h ^= h >> 16;
+	return h;
+}
 
-		res.color[0] += reflect[0] * reflectivity + refract[0] * transparency;
-		res.color[1] += reflect[1] * reflectivity + refract[1] * transparency;
-		res.color[2] += reflect[2] * reflectivity + refract[2] * transparency;
+/*
+ * The first RT_AREA_PROBES samples of the Sobol table fall one into each
+ * quadrant of the light. When they all see the same thing the point is taken
+ * to be fully lit or fully in shadow; only points in the penumbra go on to
+ * the full sample count. The pattern is shifted by a hash of the point, so
+ * neighbouring points don't share the same banding.
+ */
+double Raytracer::areaShadow(const ShadingPoint& sp, int i, const ObjectList* candidates) {
+	Light* light = _scene->getLight(i);
+	unsigned int h = pointHash(sp.point);
+	int px = h & (SAMPLE_TILE-1), py = (h >> 8) & (SAMPLE_TILE-1);
+
+	ShadowCacheStats& stats = shadowCache()->getStats(i);
+	stats.areaPoints++;
+
+	double sum = 0, first = 0;
+	bool agree = true;
+	int n = 0;
+	for (; n < _areaTable.getCount(); n++) {
+		if (n == RT_AREA_PROBES) {
+			if (agree) break;
+			stats.penumbraPoints++;
+		}
+
+		double u, v;
+		_areaTable.get(px, py, n, u, v);
+		Vec3 P2S = light->samplePoint(sp.point, u, v) - sp.point;
+		double dist = mag(P2S);
+		double visible = 0;
+		if (dist > 0 && P2S * sp.normal > 0) {
+			P2S.normalize();
+			visible = shadow(Ray(sp.point + P2S * EPS, P2S), dist, candidates, i);
+		}
+
+		if (n == 0) first = visible;
+		agree = agree && visible == first;
+		sum += visible;
+	}
+	return sum / n;
+}
+
+int Raytracer::lightSamples(const ShadingPoint& sp) {
+	int numLights = (int)_lightGrid.lights(sp.point).size();
+	if (_lightBudget > 0 && numLights > _lightBudget)
+		return _lightTree.empty() ? 0 : _lightBudget;
+	return numLights;
+}
+
+/*
+ * Within the budget every light that reaches the point is shaded with
+ * weight 1. Beyond it the
+ * picks of one point share a random offset r and use u = (s + r) / budget,
+ * which spreads them over the light tree instead of letting them pile up
+ * on the brightest branch, and each pick is weighted by 1 / (budget * pdf).
+ */
+int Raytracer::sampleLight(const ShadingPoint& sp, int s, double& weight) {
+	weight = 1;
+	const ObjectList& reaching = _lightGrid.lights(sp.point);
+	if (_lightBudget <= 0 || (int)reaching.size() <= _lightBudget)
+		return reaching[s];
+
+	unsigned int h = pointHash(sp.point) * 0x85EBCA6Bu;
+	h ^= h >> 13;
+	double r = h / 4294967296.0;
+	double pdf;
+	int i = _lightTree.sample(sp.point, (s + r) / _lightBudget, pdf);
+	if (i < 0) {
+		weight = 0; // nothing with any power reaches the point
+		return reaching[0];
 	}
-	else { // miss
-	 	// Default background color if missing all objects (default)
+	weight = 1 / (_lightBudget * pdf);
+	return i;
+}
+
+TraceResult Raytracer::trace(const Ray& ray, int depth, double c) {
+	TraceResult res;
+
+	if (depth > 5) {
 		res.color = Color(0, 0, 0);
+		return res;
 	}
 
+	/* Find best intersection for this ray */
+	HitRecord hit;
+	if (intersect(ray, hit))
+		return shade(ray, hit, depth, c);
+
+	// Default background color if missing all objects (default)
+	res.color = Color(0, 0, 0);
+	return res;
+}
+
+ShadingPoint Raytracer::shadingPoint(const Ray& ray, const HitRecord& hit) {
+	ShadingPoint sp;
+	sp.point = ray.at(hit.t);
+	sp.normal = hit.normal;
+	sp.mat = hit.mat;
+	sp.object = hit.object;
+
+	// P2V is a unit vector from hitPoint to viewer
+	sp.P2V = ray.p - sp.point;
+	sp.P2V.normalize();
+	return sp;
+}
+
+Color Raytracer::ambient(const ShadingPoint& sp) {
+	const Color ambientI = _scene->getLight(0)->getAmbient();
+	const Color ambientK = sp.mat->getAmbient();
+
+	// Ambient Intensity = kaIa
+	return Color(
+		ambientI[0] * ambientK[0],
+		ambientI[1] * ambientK[1],
+		ambientI[2] * ambientK[2]
+	);
+}
+
+Color Raytracer::directLight(const ShadingPoint& sp, int i, const ObjectList* occluders, double* visibility) {
+	if (visibility) *visibility = -1;
+	Color terms;
+	if (!lightTerms(sp, i, terms))
+		return Color(0, 0, 0);
+
+	double shadow = lightVisibility(sp, i, occluders);
+	if (visibility) *visibility = shadow;
+	return Color(
+		shadow * terms[0],
+		shadow * terms[1],
+		shadow * terms[2]
+	);
+}
+
+bool Raytracer::lightTerms(const ShadingPoint& sp, int i, Color& out) {
+	Light* light = _scene->getLight(i);
+	Color colorLight = light->getColor();
+	const Color diffuseK = sp.mat->getDiffuse();
+	const Color specularK = sp.mat->getSpecular();
+	const double specExponent = sp.mat->getSpecExponent();
+
+	// P2L is a unit vector from light to hitPoint
+	Vec3 P2L = light->getPos() - sp.point;
+	double dlight = sqrt(P2L * P2L);
+	P2L.normalize();
+
+	// Lights with a range fade out toward it
+	double falloff = light->falloff(dlight);
+	if (falloff <= 0)
+		return false;
+	colorLight = falloff * colorLight;
+
+	/* If (L•N) is 0 or negative, the light has not effect on diffuse or specular */
+	double LXN = P2L * sp.normal;
+	if (LXN <= 0)
+		return false;
+
+	// Diffuse Reflection = Kd (L•N) Ip
+	// L = Point of Intersection to Light source
+	// pointLight refers to the color of the light
+	Color diffuseI = Color(
+		diffuseK[0] * LXN * colorLight[0],
+		diffuseK[1] * LXN * colorLight[1],
+		diffuseK[2] * LXN * colorLight[2]
+	);
+
+	// Specular Reflection = Ks (R•V)^n Ip
+	// V = Point on the surface to the viewer
+	Vec3 R = 2 * LXN * sp.normal - P2L;
+	double RXVN = pow(R * sp.P2V, specExponent);
+	Color specularI = Color(
+		specularK[0] * RXVN * colorLight[0],
+		specularK[1] * RXVN * colorLight[1],
+		specularK[2] * RXVN * colorLight[2]
+	);
+
+	out = Color(
+		diffuseI[0] + specularI[0],
+		diffuseI[1] + specularI[1],
+		diffuseI[2] + specularI[2]
+	);
+	return true;
+}
+
+double Raytracer::lightVisibility(const ShadingPoint& sp, int i, const ObjectList* occluders) {
+	Light* light = _scene->getLight(i);
+	Vec3 P2L = light->getPos() - sp.point;
+	double dlight = sqrt(P2L * P2L);
+	P2L.normalize();
+
+	Pt3 hitPoint1 = sp.point + P2L * EPS;
+	Ray surfaceRay = Ray(hitPoint1, P2L);
+	const ObjectList* mapped = i < (int)_occluderMaps.size() ? _occluderMaps[i].candidates(sp.point) : NULL;
+	if(mapped && (!occluders || mapped->size() < occluders->size()))
+		occluders = mapped;
+	// Area lights are shaded as if all their light came from the center
+	return light->isArea() ? areaShadow(sp, i, occluders) : this->shadow(surfaceRay, dlight, occluders, i);
+}
+
+bool Raytracer::reflectedRay(const ShadingPoint& sp, Ray& out) {
+	if (sp.mat->getReflective() <= 0)
+		return false;
+
+	// Reflection Itensity = ksIreflected
+	// Reflected Vector W = 2(V•N)N - V
+	Vec3 W = 2 * (sp.P2V * sp.normal) * sp.normal - sp.P2V;
+	W.normalize();
+	out = Ray(sp.point, W);
+	return true;
+}
+
+bool Raytracer::refractedRay(const ShadingPoint& sp, double c, Ray& out, double& nextC) {
+	if (sp.mat->getTransparency() <= 0)
+		return false;
+
+	// Total Reflection Check
+	// (N•V)^2 + (c1 / c2)^2 < 1
+	// c1 = index of refraction from outside
+	// c2 = index of refraction of material
+	double c1 = c;
+	double c2 = c == 1 ? sp.mat->getRefractIndex() : 1;
+	double NXV = sp.normal * sp.P2V;
+	double NXV2 = NXV * NXV;
+	double totalReflection = NXV2 + (c1 / c2) * (c1 / c2);
+	if (totalReflection < 1)
+		return false;
+
+	/*
+	 * If NXV < 0, it's crossing face from inside to outside.
+	 * If you don't flip normal here, this ray is trapped inside.
+	 */
+	Vec3 refractNormal = sp.normal;
+	if (NXV < 0) refractNormal = -sp.normal;
+
+	/*
+	 * cos(Θ₂) = sqrt(1 - (c2 / c1)^2 (1 - (N•V)^2))
+	 * W = ((c2/c1)(N•V) - cos(Θ₂))N - (c2/c1)V
+	 */
+	double refractRatio = c2 / c1;
+	double cosin = sqrt(1 - (refractRatio * refractRatio) * (1 - NXV2));
+	Vec3 W = (refractRatio * (refractNormal * sp.P2V) - cosin) * refractNormal - refractRatio * sp.P2V;
+	W.normalize();
+	out = Ray(sp.point, W);
+
+	if (c == 1) // If currently in air traveling into material
+		nextC = sp.mat->getRefractIndex();
+	else // If currently in material and coming out into air
+		nextC = 1.0;
+	return true;
+}
+
+TraceResult Raytracer::shade(const Ray& ray, const HitRecord& hit, int depth, double c, const ObjectList* occluders) {
+	TraceResult res;
+	ShadingPoint sp = shadingPoint(ray, hit);
+	const double reflectivity = sp.mat->getReflective();
+	const double transparency = sp.mat->getTransparency();
+
+	// Children are recorded right after their parent, see Relighter
+	std::vector<RelightNode>* nodes = relightNodes;
+	int node = nodes ? (int)nodes->size() : -1;
+	if (nodes) nodes->push_back(RelightNode(sp));
+
+	res.color = ambient(sp);
+	int numLights = lightSamples(sp);
+	for (int s = 0; s < numLights; s++) {
+		double weight;
+		int i = sampleLight(sp, s, weight);
+		if (weight == 0) continue;
+		double visibility;
+		Color direct = directLight(sp, i, occluders ? &occluders[i] : NULL, nodes ? &visibility : NULL);
+		if (nodes && visibility >= 0)
+			(*nodes)[node].setVisibility(i, visibility);
+		res.color[0] += weight * direct[0];
+		res.color[1] += weight * direct[1];
+		res.color[2] += weight * direct[2];
+	}
+
+	Color reflect = Color(0, 0, 0);
+	Color refract = Color(0, 0, 0);
+
+	Ray secondary;
+	double nextC;
+	int child = nodes ? (int)nodes->size() : -1;
+	if (reflectedRay(sp, secondary)) {
+		reflect = trace(secondary, depth + 1).color;
+		if (nodes && (int)nodes->size() > child) (*nodes)[node].reflect = child;
+	}
+	child = nodes ? (int)nodes->size() : -1;
+	if (refractedRay(sp, c, secondary, nextC)) {
+		refract = trace(secondary, depth + 1, nextC).color;
+		if (nodes && (int)nodes->size() > child) (*nodes)[node].refract = child;
+	}
+
+	res.color[0] += reflect[0] * reflectivity + refract[0] * transparency;
+	res.color[1] += reflect[1] * reflectivity + refract[1] * transparency;
+	res.color[2] += reflect[2] * reflectivity + refract[2] * transparency;
+
 	return res;
 }
@@ -3,20 +3,80 @@
 
 #include "Rendering/ShadeAndShapes.h"
 #include "Rendering/Renderer.h"
+#include "Rendering/OccluderMap.h"
+#include "Rendering/ShadowCache.h"
+#include "Rendering/IdBuffer.h"
+#include "Rendering/Sampling.h"
+#include "Rendering/LightTree.h"
+#include "Rendering/LightGrid.h"
+#include "Rendering/PixelDependencies.h"
+#include "Rendering/Framebuffer.h"
 #include <FL/gl.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+// Tracing modes
+#define RT_MODE_RECURSIVE 0 // depth-first, one pixel (or packet) at a time
+#define RT_MODE_WAVEFRONT 1 // breadth-first, see Rendering/Wavefront.h
+
+// Largest supported packet edge; packets are traced as square tiles of rays
+#define RT_MAX_PACKET 8
+#define RT_DEFAULT_PACKET 4
+
+// Progressive refinement levels: every 4th pixel of every 4th row, then every 2nd, then all
+#define RT_PROGRESSIVE_LEVELS 3
+
+// Edge length of the screen tiles that keep their own list of visible objects
+#define RT_CULL_TILE 16
+
+// Shadow rays per area light: the probes are always cast, the rest only in the penumbra
+#define RT_AREA_PROBES 4
+#define RT_AREA_SAMPLES 16
 
 struct TraceResult {
 	// NOTE: You can add more data here for your own recursive ray tracing
 	Color color;
 };
 
+// Closest hit along a ray
+struct HitRecord {
+	double t;
+	int object; // index into the scene's object list, -1 on a miss
+	Vec3 normal;
+	Material* mat;
+	HitRecord() : t(DINF), object(-1), mat(NULL) {}
+};
+
+// Everything the lighting computation needs to know about a hit
+struct ShadingPoint {
+	Pt3 point;
+	Vec3 normal;
+	Vec3 P2V; // unit vector from the point to the viewer
+	Material* mat;
+	int object;
+};
+
+class WavefrontRenderer;
+class Antialiaser;
+class Denoiser;
+class Upsampler;
+class Relighter;
+
+// A list of object indices that a ray has to be tested against
+typedef std::vector<int> ObjectList;
+
 class Raytracer : public Renderer {
 protected:
-	Intersector _intersector;
-
-	float*  _pixels;
+	Framebuffer _image;
+	int _format; // of the next frame's image
 	int _width;
 	int _height;
+	// The image shows rows [_bandY, _bandY+_height) of the viewport, all of them when _bandRows is 0
+	int _bandY, _bandRows;
+	// Rows written since the display last took them, see takeDirtyRows()
+	std::atomic<bool>* _dirtyRows;
 
 	GLdouble _modelview[16], _proj[16];
 	GLint _view[4];
@@ -25,20 +85,225 @@ protected:
 	Mat4 _invFinal;
 
 	int _last;
+	int _mode;
+
+	// Progressive mode traces the image coarse to fine; _level is the level in progress
+	bool _progressive;
+	int _level;
+	// Set once every pixel has its primary sample, anti-aliasing runs after that
+	bool _baseDone;
+
+	// Object seen through each pixel, -1 for the background, with the normal
+	// (3 floats per pixel) and distance of the hit; they guide the denoiser
+	std::vector<int> _primaryIds;
+	std::vector<float> _primaryNormals;
+	std::vector<float> _primaryDepths;
+	bool _denoised;
+
+	// Edge length of the square ray packets, 1 traces single rays in scanline order
+	int _packetSize;
+
+	// Per-object world-space bounds, refreshed in drawInit
+	std::vector<BoundingBox> _bounds;
+	BoundingBox _sceneBounds;
+
+	// Objects whose projected bounds overlap each screen tile, in scene order
+	std::vector<ObjectList> _tileObjects;
+	int _tilesX, _tilesY;
+
+	// Shadow candidates per light, and the object bounds they were built from
+	std::vector<OccluderMap> _occluderMaps;
+	std::vector<BoundingBox> _mappedBounds;
+
+	// Shadow caches of the threads that traced this frame; _generation changes with every frame
+	std::vector<ShadowCache*> _shadowCaches;
+	std::mutex _cacheMutex;
+	int _generation;
+
+	// Rasterized object IDs and depths for primary visibility, see primaryHit()
+	bool _rasterPrimary;
+	IdBuffer _idBuffer;
+	std::atomic<long long> _rasterResolved, _rasterFallbacks;
+
+	// Positions of the shadow samples on area lights
+	SampleTable _areaTable;
+
+	// Lights shaded per point when the scene has more than that, picked from
+	// _lightTree; 0 shades every light at every point
+	int _lightBudget;
+	LightTree _lightTree;
+	// Lights that can reach each part of the scene, see Light::getRange()
+	LightGrid _lightGrid;
+
+	// Incremental re-rendering: the grid cells each pixel's rays passed through,
+	// and the state of the scene they were traced in (snapshots of one scene
+	// share its lineage); a partial frame only
+	// retraces the _dirty pixels, listed packet tile by packet tile, a relit
+	// frame only shades again
+	bool _incremental;
+	bool _recording;
+	bool _partial;
+	bool _relit;
+	PixelDependencies _dependencies;
+	int _stateScene;
+	std::vector<double> _viewState;
+	std::vector<std::vector<double> > _lightStates;
+	std::vector<std::vector<double> > _objectStates;
+	std::vector<std::vector<double> > _materialStates;
+	std::vector<int> _dirty;
+
+	WavefrontRenderer* _wavefront;
+	Antialiaser* _antialiaser;
+	Denoiser* _denoiser;
+	Upsampler* _upsampler;
+	Relighter* _relighter;
+
+	void updateBounds();
+	void updateTiles();
+	void updateOccluderMaps();
+	void updateIdBuffer();
+	void updateLights();
+	std::vector<double> viewState();
+	std::vector<double> lightState(int light);
+	std::vector<double> objectState(int object);
+	std::vector<double> materialState(int object);
+	void planIncremental();
+	bool drawDirty(int step);
+	bool findPrimaryHit(int x, int y, const Ray& ray, HitRecord& hit, const ObjectList* fallback);
+	void clearShadowCaches();
+	ShadowCache* shadowCache();
+	bool drawBase(int step);
+	bool drawProgressive(int step);
+	// Traces the packet at (x0, y0), or only the count pixels of it listed in pixels
+	void drawPacket(int x0, int y0, const int* pixels = NULL, int count = 0);
 
 public:
 	Raytracer();
+	~Raytracer();
 	virtual void draw() {}
 	virtual void drawInit(GLdouble modelview[16], GLdouble proj[16], GLint view[4]);
 	virtual bool draw(int step);
 
+	// Pixel coordinates, counted from the lower left corner of the viewport, and
+	// window depth to world space
 	Pt3 unproject(const Pt3& p);
+	Ray primaryRay(double x, double y);
+
+	// Finds the closest hit, testing only the given candidates when they are supplied
+	bool intersect(const Ray& ray, HitRecord& hit, const ObjectList* candidates = NULL);
+	// Returns how much light gets through along the ray up to distance dlight;
+	// when light is given the calling thread's shadow cache for it is used
+	double shadow(const Ray& ray, double dlight, const ObjectList* candidates = NULL, int light = -1);
+	// Fraction of an area light that reaches the shading point
+	double areaShadow(const ShadingPoint& sp, int light, const ObjectList* candidates = NULL);
+
+	// Objects a primary ray through pixel (x, y) can hit first
+	const ObjectList* primaryCandidates(int x, int y);
+	// Same for all pixels of the rectangle [x0, x1] x [y0, y1], merged into out
+	void primaryCandidates(int x0, int y0, int x1, int y1, ObjectList& out);
+
+	// First hit of the primary ray through pixel (x, y); fallback (the pixel's tile list
+	// when NULL) holds the objects to trace against when the ID buffer can't decide
+	bool primaryHit(int x, int y, const Ray& ray, HitRecord& hit, const ObjectList* fallback = NULL);
 
 	TraceResult trace(const Ray& ray, int depth, double c = 1.0);
+	// Shades a known hit; occluders holds one shadow candidate list per light, or NULL for all objects
+	TraceResult shade(const Ray& ray, const HitRecord& hit, int depth, double c, const ObjectList* occluders = NULL);
+
+	// Building blocks of shade(), shared with the wavefront renderer
+	ShadingPoint shadingPoint(const Ray& ray, const HitRecord& hit);
+	Color ambient(const ShadingPoint& sp);
+	// occluders limits the shadow test for this light; the light's occluder map is used when it is smaller.
+	// visibility, when given, receives the shadow factor, or -1 when no shadow test was needed
+	Color directLight(const ShadingPoint& sp, int light, const ObjectList* occluders = NULL, double* visibility = NULL);
+	// Unshadowed diffuse plus specular light at the point; false when the light doesn't reach it
+	bool lightTerms(const ShadingPoint& sp, int light, Color& out);
+	// Shadow factor of the light at the point
+	double lightVisibility(const ShadingPoint& sp, int light, const ObjectList* occluders = NULL);
+	bool reflectedRay(const ShadingPoint& sp, Ray& out);
+	bool refractedRay(const ShadingPoint& sp, double c, Ray& out, double& nextC);
+	// Number of lights shade() evaluates at the point, and the s-th of them with
+	// the weight its directLight() gets; lights out of range are left out
+	int lightSamples(const ShadingPoint& sp);
+	int sampleLight(const ShadingPoint& sp, int s, double& weight);
+
+	void setPixel(int x, int y, const Color& color);
+	// Marks rows [y0, y1) as changed, for writes that bypass setPixel()
+	void touchRows(int y0, int y1);
+	// Finds the first run [y0, y1) of changed rows at or after row from and
+	// clears their marks; false when no row changed. Safe to call while
+	// another thread draws.
+	bool takeDirtyRows(int from, int& y0, int& y1);
+	// Traces pixel (x, y) into the image; threads may trace different pixels at once
+	void drawPixel(int x, int y);
+	// Writes the current image as a BMP, PPM or PNG file, see ImageWriter, or
+	// with its float colors as a PFM or EXR file, see HdrWriter. Float files
+	// can add the depth, normal and object buffers; srgb only applies to
+	// 8-bit files and rle only to EXR files.
+	bool saveImage(const std::string& fname, bool srgb = false, bool aovs = false, bool rle = true);
+
+	void setMode(int mode) { _mode = mode; }
+	int getMode() { return _mode; }
+	WavefrontRenderer* getWavefront() { return _wavefront; }
+	Antialiaser* getAntialiaser() { return _antialiaser; }
+	Denoiser* getDenoiser() { return _denoiser; }
+	Upsampler* getUpsampler() { return _upsampler; }
+	Relighter* getRelighter() { return _relighter; }
+	int getPrimaryObject(int x, int y) { return _primaryIds[x + y*_width]; }
+	const int* getPrimaryIds() { return _primaryIds.data(); }
+	const float* getPrimaryNormals() { return _primaryNormals.data(); }
+	const float* getPrimaryDepths() { return _primaryDepths.data(); }
+	const BoundingBox& getSceneBounds() { return _sceneBounds; }
+	// Shadow cache counters of one light, summed over all threads of the current frame
+	ShadowCacheStats getShadowStats(int light);
+	void printShadowStats();
+
+	// Re-renders only the pixels an object edit can change, see planIncremental();
+	// material and light edits are handled by the relighter when it is enabled
+	void setIncremental(bool b) { _incremental = b; }
+	bool getIncremental() { return _incremental; }
+	// Pixel whose ray tree the calling thread traces next, -1 for none
+	void setTracingPixel(int pixel);
+	// Drops the records of a frame that was cancelled before it finished; the
+	// next frame is traced in full
+	void discardRecords();
+	void printIncrementalStats();
+
+	// Renders only rows [y0, y0+rows) of the viewport of the next frames, into
+	// an image of that height whose rays are the same as the full image's;
+	// rows <= 0 renders the whole viewport. Rasterized primary visibility
+	// and denoising work on whole viewports only.
+	void setBand(int y0, int rows) { _bandY = rows > 0 ? max(y0, 0) : 0; _bandRows = max(rows, 0); }
+	int getBandY() { return _bandY; }
+
+	// Takes primary hits from a rasterized ID buffer instead of tracing every primary ray
+	void setRasterPrimary(bool b) { _rasterPrimary = b; }
+	bool getRasterPrimary() { return _rasterPrimary; }
+	void printPrimaryStats();
+
+	void setProgressive(bool b) { _progressive = b; }
+	bool getProgressive() { return _progressive; }
+	// Number of progressive levels completed so far
+	int getProgressLevel() { return _level; }
+
+	// Lights (and so shadow rays to point lights) per shading point, 0 for all of them
+	void setLightBudget(int n) { _lightBudget = n < 0 ? 0 : n; }
+	int getLightBudget() { return _lightBudget; }
+
+	// Shadow rays per area light at penumbra points
+	void setAreaSamples(int n) { _areaTable = SampleTable(SAMPLE_SOBOL, n); }
+	int getAreaSamples() { return _areaTable.getCount(); }
+
+	void setPacketSize(int size) { _packetSize = size < 1 ? 1 : (size > RT_MAX_PACKET ? RT_MAX_PACKET : size); }
+	int getPacketSize() { return _packetSize; }
 
 	int getWidth() { return _width; }
 	int getHeight() { return _height; }
-	float* getPixels() { return _pixels; }
+	// Pixel format of the image, takes effect with the next frame
+	void setFormat(int format) { _format = format; }
+	int getFormat() { return _format; }
+	Color getPixel(int x, int y) { return _image.get(x, y); }
+	const Framebuffer& getImage() { return _image; }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,107 @@
+#include "Rendering/Relighter.h"
+#include <iostream>
+
+using namespace std;
+
+void RelightNode::setVisibility(int light, double v) {
+	for(size_t k = 0; k < visibility.size(); k++) {
+		if(visibility[k].first == light) {
+			visibility[k].second = v;
+			return;
+		}
+	}
+	visibility.push_back(make_pair(light, v));
+}
+
+void Relighter::reset(int width, int height) {
+	_width = width;
+	_height = height;
+	_nodes.assign(width*height, vector<RelightNode>());
+	_valid = true;
+	_shaded = _shadowRays = 0;
+}
+
+void Relighter::invalidate() {
+	_nodes.clear();
+	_valid = false;
+	_shaded = _shadowRays = 0;
+}
+
+void Relighter::begin(const vector<char>& moved) {
+	_moved = moved;
+	_last = 0;
+	_shaded = _shadowRays = 0;
+}
+
+bool Relighter::draw(int step) {
+	int size = _width*_height;
+	int k;
+	for(k = _last; k < size && k < _last+step; k++) {
+		Color color(0, 0, 0);
+		if(!_nodes[k].empty()) {
+			// The records may come from another snapshot of the scene
+			Scene* scene = _tracer->getScene();
+			for(size_t n = 0; n < _nodes[k].size(); n++)
+				_nodes[k][n].sp.mat = scene->getMaterial(scene->getObject(_nodes[k][n].sp.object));
+			_tracer->setTracingPixel(k);
+			color = reshade(_nodes[k], 0);
+			_tracer->setTracingPixel(-1);
+			_shaded++;
+		}
+		color[3] = 1;
+		_tracer->setPixel(k % _width, k / _width, color);
+	}
+	_last = k;
+	return (_last >= size);
+}
+
+/*
+ * Same sums in the same order as Raytracer::shade(), with the shadow tests
+ * and the traced children taken from the records.
+ */
+Color Relighter::reshade(vector<RelightNode>& nodes, int n) {
+	const ShadingPoint& sp = nodes[n].sp;
+	Color color = _tracer->ambient(sp);
+	int numLights = _tracer->lightSamples(sp);
+	for(int s = 0; s < numLights; s++) {
+		double weight;
+		int i = _tracer->sampleLight(sp, s, weight);
+		if(weight == 0) continue;
+
+		Color direct(0, 0, 0);
+		Color terms;
+		if(_tracer->lightTerms(sp, i, terms)) {
+			double shadow = visibility(nodes[n], i);
+			direct = Color(shadow * terms[0], shadow * terms[1], shadow * terms[2]);
+		}
+		color[0] += weight * direct[0];
+		color[1] += weight * direct[1];
+		color[2] += weight * direct[2];
+	}
+
+	Color reflect = nodes[n].reflect >= 0 ? reshade(nodes, nodes[n].reflect) : Color(0, 0, 0);
+	Color refract = nodes[n].refract >= 0 ? reshade(nodes, nodes[n].refract) : Color(0, 0, 0);
+	const double reflectivity = sp.mat->getReflective();
+	const double transparency = sp.mat->getTransparency();
+	color[0] += reflect[0] * reflectivity + refract[0] * transparency;
+	color[1] += reflect[1] * reflectivity + refract[1] * transparency;
+	color[2] += reflect[2] * reflectivity + refract[2] * transparency;
+	return color;
+}
+
+// Recorded visibility of the light, cast again when the light moved or wasn't tested before
+double Relighter::visibility(RelightNode& node, int light) {
+	if(!_moved[light]) {
+		for(size_t k = 0; k < node.visibility.size(); k++)
+			if(node.visibility[k].first == light)
+				return node.visibility[k].second;
+	}
+	_shadowRays++;
+	double v = _tracer->lightVisibility(node.sp, light);
+	node.setVisibility(light, v);
+	return v;
+}
+
+void Relighter::printStats() {
+	cout << "Relighting: reshaded " << _shaded << " pixels, cast " << _shadowRays << " shadow tests" << endl;
+}
@@ -0,0 +1,66 @@
+#ifndef RELIGHTER_H
+#define RELIGHTER_H
+
+#include "Rendering/Raytracer.h"
+#include <utility>
+#include <vector>
+
+// A shaded hit of a pixel's ray tree, in the order shade() reached them
+struct RelightNode {
+	ShadingPoint sp;
+	int reflect, refract; // child nodes, -1 when the ray wasn't traced or missed
+	std::vector<std::pair<int, double> > visibility; // (light, shadow factor) of the lights tested
+
+	RelightNode(const ShadingPoint& p) : sp(p), reflect(-1), refract(-1) {}
+	void setVisibility(int light, double v);
+};
+
+/*
+ * Relighting cache. While recording, shade() keeps every hit of a pixel's
+ * ray tree: point, normal, material, the reflected and refracted children
+ * and how visible each light was. As long as nothing moved, the image can be
+ * shaded again from these records alone: color and specular edits of
+ * materials and lights need no rays at all, and a moved light only needs new
+ * shadow rays toward that light. Edits that change the ray tree itself
+ * (reflectivity turned on or off, transparency, refraction index) need a
+ * full trace.
+ */
+class Relighter {
+protected:
+	Raytracer* _tracer;
+	bool _enabled;
+	bool _valid; // every pixel of the image has its records
+
+	int _width;
+	int _height;
+	std::vector<std::vector<RelightNode> > _nodes;
+	std::vector<char> _moved; // lights whose shadows have to be cast again
+	int _last;
+	long long _shaded, _shadowRays;
+
+	Color reshade(std::vector<RelightNode>& nodes, int n);
+	double visibility(RelightNode& node, int light);
+
+public:
+	Relighter(Raytracer* tracer) : _tracer(tracer), _enabled(false), _valid(false),
+		_width(0), _height(0), _last(0), _shaded(0), _shadowRays(0) {}
+
+	void setEnabled(bool b) { _enabled = b; }
+	bool getEnabled() { return _enabled; }
+
+	// Starts recording a width x height image, or drops the records
+	void reset(int width, int height);
+	void invalidate();
+	bool valid() { return _valid; }
+	std::vector<RelightNode>& nodes(int pixel) { return _nodes[pixel]; }
+
+	// Prepares shading the recorded image again; moved flags the lights whose
+	// position or shape changed
+	void begin(const std::vector<char>& moved);
+	// Processes up to step pixels, returns true when every pixel is shaded
+	bool draw(int step);
+
+	void printStats();
+};
+
+#endif
@@ -8,7 +8,9 @@ protected:
 	Scene* _scene;
 public:
 	Renderer() { _scene = NULL; }
+	virtual ~Renderer() {}
 	void setScene(Scene* s) { _scene = s; }
+	Scene* getScene() { return _scene; }
 	virtual void draw() = 0;
 };
 
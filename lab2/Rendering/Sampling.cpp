@@ -0,0 +1,124 @@
+#include "Rendering/Sampling.h"
+#include <cmath>
+
+using namespace std;
+
+// Small deterministic generator so that tables are the same on every run
+static unsigned int hashInt(unsigned int x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static double hashDouble(unsigned int x) {
+	return hashInt(x) / 4294967296.0;
+}
+
+SampleTable::SampleTable(int type, int count) : _type(type) {
+	_count = count < 1 ? 1 : (count > SAMPLE_MAX_COUNT ? SAMPLE_MAX_COUNT : count);
+
+	if(type == SAMPLE_STRATIFIED)
+		buildStratified();
+	else if(type == SAMPLE_BLUE_NOISE)
+		buildBlueNoise();
+	else {
+		_type = SAMPLE_SOBOL;
+		buildSobol();
+	}
+
+	_offsets.resize(SAMPLE_TILE*SAMPLE_TILE*2);
+	for(int k = 0; k < SAMPLE_TILE*SAMPLE_TILE; k++) {
+		_offsets[k*2] = hashDouble(2*k + 0x9e3779b9u);
+		_offsets[k*2+1] = hashDouble(2*k+1 + 0x9e3779b9u);
+	}
+}
+
+// One jittered sample per cell of an n x n grid, cells visited in a shuffled order
+void SampleTable::buildStratified() {
+	int n = (int)ceil(sqrt((double)_count));
+	_count = n*n;
+	if(_count > SAMPLE_MAX_COUNT) {
+		n = (int)sqrt((double)SAMPLE_MAX_COUNT);
+		_count = n*n;
+	}
+
+	vector<int> order(_count);
+	for(int k = 0; k < _count; k++)
+		order[k] = k;
+	for(int k = _count-1; k > 0; k--) {
+		int j = hashInt(k) % (k+1);
+		int t = order[k];
+		order[k] = order[j];
+		order[j] = t;
+	}
+
+	_points.resize(_count*2);
+	for(int k = 0; k < _count; k++) {
+		int cell = order[k];
+		_points[k*2] = (cell % n + hashDouble(3*k)) / n;
+		_points[k*2+1] = (cell / n + hashDouble(3*k+1)) / n;
+	}
+}
+
+/*
+ * Dimension 0 is the van der Corput sequence, dimension 1 uses the
+ * direction numbers of the primitive polynomial x + 1. Any power-of-two
+ * prefix is stratified in both dimensions.
+ */
+void SampleTable::buildSobol() {
+	unsigned int v0[32], v1[32];
+	for(int k = 0; k < 32; k++)
+		v0[k] = 1u << (31-k);
+	v1[0] = 1u << 31;
+	for(int k = 1; k < 32; k++)
+		v1[k] = v1[k-1] ^ (v1[k-1] >> 1);
+
+	_points.resize(_count*2);
+	for(int i = 0; i < _count; i++) {
+		unsigned int x = 0, y = 0;
+		for(int k = 0; k < 32; k++) {
+			if(i & (1 << k)) {
+				x ^= v0[k];
+				y ^= v1[k];
+			}
+		}
+		_points[i*2] = x / 4294967296.0;
+		_points[i*2+1] = y / 4294967296.0;
+	}
+}
+
+/*
+ * Mitchell's best-candidate algorithm on the torus: every new point is the
+ * candidate farthest from all previous ones, out of a number of random
+ * candidates that grows with the points already placed (up to 64, which
+ * builds a full table in about a tenth of a second).
+ */
+void SampleTable::buildBlueNoise() {
+	_points.resize(_count*2);
+	unsigned int seed = 1;
+	for(int i = 0; i < _count; i++) {
+		double bestU = 0, bestV = 0, bestDist = -1;
+		int candidates = 4*i + 1 < 64 ? 4*i + 1 : 64;
+		for(int c = 0; c < candidates; c++) {
+			double u = hashDouble(seed++), v = hashDouble(seed++);
+			double nearest = 2;
+			for(int j = 0; j < i && nearest > bestDist; j++) {
+				double du = fabs(u - _points[j*2]), dv = fabs(v - _points[j*2+1]);
+				if(du > 0.5) du = 1 - du;
+				if(dv > 0.5) dv = 1 - dv;
+				double d = du*du + dv*dv;
+				if(d < nearest) nearest = d;
+			}
+			if(nearest > bestDist) {
+				bestDist = nearest;
+				bestU = u;
+				bestV = v;
+			}
+		}
+		_points[i*2] = bestU;
+		_points[i*2+1] = bestV;
+	}
+}
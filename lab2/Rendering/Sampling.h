@@ -0,0 +1,52 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <vector>
+
+// Sample patterns
+#define SAMPLE_STRATIFIED 0 // jittered grid
+#define SAMPLE_SOBOL 1 // first two Sobol dimensions
+#define SAMPLE_BLUE_NOISE 2 // best-candidate points, every prefix is well spread
+
+// Largest number of samples per pixel a table holds
+#define SAMPLE_MAX_COUNT 1024
+// Edge length of the tile of per-pixel offsets; tables repeat every SAMPLE_TILE pixels
+#define SAMPLE_TILE 64
+
+/*
+ * Precomputed 2D sample positions in [0, 1)^2 shared by all pixels. Each
+ * pixel shifts the pattern by its own toroidal offset (Cranley-Patterson
+ * rotation), so neighbouring pixels don't repeat the same error while every
+ * pixel keeps the distribution of the pattern. Looking up a sample is a table
+ * read and two additions, cheap enough for per-pixel loops.
+ */
+class SampleTable {
+protected:
+	int _type;
+	int _count;
+	std::vector<double> _points; // _count (u, v) pairs
+	std::vector<double> _offsets; // SAMPLE_TILE x SAMPLE_TILE (u, v) pairs
+
+	void buildStratified();
+	void buildSobol();
+	void buildBlueNoise();
+
+public:
+	// count is clamped to [1, SAMPLE_MAX_COUNT]; stratified tables round it up to a square
+	SampleTable(int type = SAMPLE_SOBOL, int count = 16);
+
+	int getType() const { return _type; }
+	int getCount() const { return _count; }
+
+	// Sample i of pixel (x, y); samples past the end of the table wrap around
+	void get(int x, int y, int i, double& u, double& v) const {
+		const double* p = &_points[(i % _count) * 2];
+		const double* o = &_offsets[((x & (SAMPLE_TILE-1)) + (y & (SAMPLE_TILE-1))*SAMPLE_TILE) * 2];
+		u = p[0] + o[0];
+		v = p[1] + o[1];
+		if(u >= 1) u -= 1;
+		if(v >= 1) v -= 1;
+	}
+};
+
+#endif
@@ -6,6 +6,8 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <cctype>
+#include <algorithm>
 
 #include <FL/gl.h>
 
@@ -61,6 +63,82 @@ void writeString(ostream* stream, const string& s) {
 	(*stream) << s;
 }
 
+static int nextLineage = 0;
+
+Scene::Scene() : _lineage(nextLineage++), _version(0), _origin(NULL) {}
+
+// Snapshots outlive the scene and keep the primitives they share
+Scene::~Scene() {
+	for(size_t k = 0; k < _snapshots.size(); k++)
+		_snapshots[k]->_origin = NULL;
+	if(_origin)
+		_origin->_snapshots.erase(find(_origin->_snapshots.begin(), _origin->_snapshots.end(), this));
+}
+
+Scene* Scene::snapshot() {
+	Scene* snap = new Scene();
+	snap->_objs = _objs;
+	snap->_lights = _lights;
+	snap->_mats = _mats;
+	snap->_modelview = _modelview;
+	snap->_translate = _translate;
+	snap->_rotate = _rotate;
+	snap->_lineage = _lineage;
+	snap->_version = _version;
+	snap->_origin = this;
+	_snapshots.push_back(snap);
+	return snap;
+}
+
+void Scene::release(Scene* snapshot) {
+	Scene* origin = snapshot->_origin;
+	delete snapshot;
+	if(origin)
+		origin->collect();
+}
+
+bool Scene::shared(SceneObject* obj) {
+	for(size_t k = 0; k < _snapshots.size(); k++) {
+		Scene* snap = _snapshots[k];
+		if(find(snap->_objs.begin(), snap->_objs.end(), obj) != snap->_objs.end()) return true;
+		for(map<Geometry*, Material*>::iterator it = snap->_mats.begin(); it != snap->_mats.end(); it++)
+			if(it->second == obj) return true;
+	}
+	return false;
+}
+
+// Frees the replaced primitives no snapshot shares anymore
+void Scene::collect() {
+	vector<SceneObject*> kept;
+	for(size_t k = 0; k < _retired.size(); k++) {
+		if(shared(_retired[k]))
+			kept.push_back(_retired[k]);
+		else
+			delete _retired[k];
+	}
+	_retired.swap(kept);
+}
+
+Geometry* Scene::editObject(Geometry* obj) {
+	_version++;
+	if(!shared(obj)) return obj;
+	Geometry* copy = obj->clone();
+	replace(_objs.begin(), _objs.end(), obj, copy);
+	_mats[copy] = _mats[obj];
+	_mats.erase(obj);
+	_retired.push_back(obj);
+	return copy;
+}
+
+Material* Scene::editMaterial(Material* mat) {
+	_version++;
+	if(!shared(mat)) return mat;
+	Material* copy = new Material(*mat);
+	for(map<Geometry*, Material*>::iterator it = _mats.begin(); it != _mats.end(); it++)
+		if(it->second == mat) it->second = copy;
+	_retired.push_back(mat);
+	return copy;
+}
 
 bool SceneUtils::writeScene(const std::string& fname, Scene* scene) {
 	std::ofstream fout(fname.c_str());
@@ -196,11 +274,32 @@ void ReadSceneObjectVisitor::visit(Material* mat, void* ret) {
 	mat->setRefractIndex(readDouble(_stream));
 }
 
+// A light may start with "range r" to limit its reach, and then with its shape
+// ("rect" or "sphere") for area lights; point lights go straight to their position
 void ReadSceneObjectVisitor::visit(Light* light, void* ret) {
+	string shape;
+	(*_stream) >> ws;
+	while(shape.empty() && isalpha(_stream->peek())) {
+		string word = readString(_stream);
+		if(word == "range")
+			light->setRange(readDouble(_stream));
+		else
+			shape = word;
+		(*_stream) >> ws;
+	}
+
 	Pt3 pos = readPt3(_stream);
 	Color color = readPt3(_stream);
 	light->setPos(pos);
 	light->setColor(color);
+
+	if(shape == "rect") {
+		Vec3 u = readVec3(_stream);
+		Vec3 v = readVec3(_stream);
+		light->setRect(u, v);
+	} else if(shape == "sphere") {
+		light->setSphere(readDouble(_stream));
+	}
 }
 
 void ReadSceneObjectVisitor::visit(Box* box, void* ret) {
@@ -275,10 +374,29 @@ void WriteSceneObjectVisitor::visit(Material* mat, void* ret) {
 }
 
 void WriteSceneObjectVisitor::visit(Light* light, void* ret) {
+	if(light->getRange() > 0) {
+		writeString(_stream, "range"); (*_stream) << " ";
+		writeDouble(_stream, light->getRange());
+		(*_stream) << endl;
+	}
+	if(light->getShape() == LIGHT_RECT) {
+		writeString(_stream, "rect"); (*_stream) << endl;
+	} else if(light->getShape() == LIGHT_SPHERE) {
+		writeString(_stream, "sphere"); (*_stream) << endl;
+	}
 	writePt3(_stream, light->getPos());
 	(*_stream) << endl;
 	writePt3(_stream, light->getColor());
 	(*_stream) << endl;
+	if(light->getShape() == LIGHT_RECT) {
+		writeVec3(_stream, light->getEdgeU());
+		(*_stream) << endl;
+		writeVec3(_stream, light->getEdgeV());
+		(*_stream) << endl;
+	} else if(light->getShape() == LIGHT_SPHERE) {
+		writeDouble(_stream, light->getRadius());
+		(*_stream) << endl;
+	}
 }
 
 void WriteSceneObjectVisitor::visit(Box* op, void* ret) {
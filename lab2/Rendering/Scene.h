@@ -27,27 +27,48 @@ public:
 
 class SceneObject {
 public:
+	virtual ~SceneObject() {}
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) = 0;
 };
 
+/*
+ * Copy-on-write versions. A snapshot is a Scene sharing the objects, lights
+ * and materials the scene had when it was taken; a render keeps one, so it
+ * sees the same scene from start to end while the user goes on editing.
+ * Edits ask for an editable version of a primitive first: while a snapshot
+ * still shares it, the primitive is copied, the copy takes its place in this
+ * scene and the old one is kept until no snapshot shares it anymore.
+ * Unchanged primitives are never copied.
+ */
 class Scene {
 protected:
 	std::vector<Geometry*> _objs;
 	std::vector<Light*> _lights;
 	std::map<Geometry*, Material*> _mats;
 
+	int _lineage; // same for a scene and its snapshots
+	int _version; // changes with every edit
+	Scene* _origin; // scene a snapshot was taken from, NULL for the others
+	std::vector<Scene*> _snapshots;
+	std::vector<SceneObject*> _retired; // replaced by copies, still shared by snapshots
+
+	bool shared(SceneObject* obj);
+	void collect();
+
 	Matrix<double, 4> _modelview;
 	// these two matrices are the two that are saved in the file
 	Matrix<double, 4> _translate;
 	Matrix<double, 4> _rotate;
 
 public:
-	Scene() {}
+	Scene();
+	~Scene();
 
-	void addLight(Light* light) { _lights.push_back(light); }
-	void addObject(Geometry* obj) {	_objs.push_back(obj); }
-	void attachMaterial(Geometry* obj, Material* mat) { _mats[obj] = mat; }
+	void addLight(Light* light) { _lights.push_back(light); _version++; }
+	void addObject(Geometry* obj) {	_objs.push_back(obj); _version++; }
+	void attachMaterial(Geometry* obj, Material* mat) { _mats[obj] = mat; _version++; }
 	void removeObject(Geometry* obj) {
+		_version++;
 		std::vector<Geometry*>::iterator it = _objs.begin();
 		while (it != _objs.end()) {
 			if (*it == obj) {
@@ -68,6 +89,19 @@ public:
 	Matrix<double, 4>* getModelview() { return &_modelview; }
 	Matrix<double, 4>* getTranslate() { return &_translate; }
 	Matrix<double, 4>* getRotate() { return &_rotate; }
+
+	// Pins the current version of the scene; give it back with release()
+	Scene* snapshot();
+	static void release(Scene* snapshot);
+	int getLineage() { return _lineage; }
+	int getVersion() { return _version; }
+
+	// Versions of the primitives that can be changed without the snapshots
+	// seeing it. They may be copies, which replace the old ones in this scene,
+	// so callers have to use the returned pointers from then on. Each call
+	// counts as an edit for getVersion().
+	Geometry* editObject(Geometry* obj);
+	Material* editMaterial(Material* mat);
 };
 
 class SceneUtils {
@@ -21,6 +21,43 @@ Mat4 axisRotationMatrix(double d, int axis) {
 	return move(m);
 }
 
+//========================================================================
+// Area lights
+//========================================================================
+
+double Light::getExtent() const {
+	switch(_shape) {
+		case LIGHT_RECT: return 0.5*max(mag(_edgeU + _edgeV), mag(_edgeU - _edgeV));
+		case LIGHT_SPHERE: return _radius;
+		default: return 0;
+	}
+}
+
+/*
+ * Rectangles map the sample straight onto the two edges. A sphere looks the
+ * same from every direction, so it's sampled as the disk facing the point,
+ * with the radius taken as sqrt(u) to spread the samples evenly over the area.
+ */
+Pt3 Light::samplePoint(const Pt3& from, double u, double v) const {
+	switch(_shape) {
+		case LIGHT_RECT:
+			return _pos + (u - 0.5)*_edgeU + (v - 0.5)*_edgeV;
+		case LIGHT_SPHERE: {
+			Vec3 w = from - _pos;
+			if(mag2(w) == 0) return _pos;
+			w.normalize();
+			Vec3 a = fabs(w[0]) < 0.9 ? Vec3(1, 0, 0, 0) : Vec3(0, 1, 0, 0);
+			a = cross(w, a);
+			a.normalize();
+			Vec3 b = cross(w, a);
+			double rho = _radius*sqrt(u), phi = 2*M_PI*v;
+			return _pos + rho*cos(phi)*a + rho*sin(phi)*b;
+		}
+		default:
+			return _pos;
+	}
+}
+
 //========================================================================
 // translate() and rotate()
 //========================================================================
@@ -683,3 +720,145 @@ void Intersector::visit(Cone* cone, void* ret) {
 		iret->t = iret->t / lenofnewDir;
   }
 }
+
+
+//========================================================================
+// BoundsVisitor::visit()
+//========================================================================
+
+// Transforms the corners of the canonical shape's box [lo, hi] into world space
+static void transformedBounds(Geometry* geom, const Pt3& lo, const Pt3& hi, BoundingBox* box) {
+	const Mat4& mat = geom->getForwardMat();
+	*box = BoundingBox();
+	for(int j = 0; j < 8; j++) {
+		Pt3 corner(j&1 ? hi[0] : lo[0], j&2 ? hi[1] : lo[1], j&4 ? hi[2] : lo[2]);
+		Pt3 p = corner * mat;
+		p /= p[3];
+		box->extend(p);
+	}
+}
+
+void BoundsVisitor::visit(Sphere* sphere, void* ret) {
+	BoundingBox* box = (BoundingBox*) ret;
+	Pt3 c = sphere->getCenter();
+	double r = sphere->getRadius();
+	*box = BoundingBox(Pt3(c[0]-r, c[1]-r, c[2]-r), Pt3(c[0]+r, c[1]+r, c[2]+r));
+}
+
+// Canonical box: unit cube [0,1]^3
+void BoundsVisitor::visit(Box* op, void* ret) {
+	transformedBounds(op, Pt3(0, 0, 0), Pt3(1, 1, 1), (BoundingBox*) ret);
+}
+
+// Canonical ellipsoid: unit sphere at the origin
+void BoundsVisitor::visit(Ellipsoid* op, void* ret) {
+	transformedBounds(op, Pt3(-1, -1, -1), Pt3(1, 1, 1), (BoundingBox*) ret);
+}
+
+// Canonical cylinder and cone: unit radius around the z axis, z within [0,1]
+void BoundsVisitor::visit(Cylinder* op, void* ret) {
+	transformedBounds(op, Pt3(-1, -1, 0), Pt3(1, 1, 1), (BoundingBox*) ret);
+}
+
+void BoundsVisitor::visit(Cone* op, void* ret) {
+	transformedBounds(op, Pt3(-1, -1, 0), Pt3(1, 1, 1), (BoundingBox*) ret);
+}
+
+static void addTriangle(std::vector<Pt3>* tris, const Mat4& mat, const Pt3& a, const Pt3& b, const Pt3& c) {
+	const Pt3* corners[3] = { &a, &b, &c };
+	for(int j = 0; j < 3; j++) {
+		Pt3 p = (*corners[j]) * mat;
+		p /= p[3];
+		tris->push_back(p);
+	}
+}
+
+// Latitude/longitude mesh of a unit sphere whose faces all lie outside of it
+static void tessellateSphere(std::vector<Pt3>* tris, const Mat4& mat) {
+	const int n = TESSELLATION_SEGMENTS;
+	const double grow = 1/cos(1.5*M_PI/n);
+	std::vector<Pt3> grid;
+	for(int j = 0; j <= n/2; j++) {
+		double theta = M_PI*j/(n/2);
+		for(int i = 0; i < n; i++) {
+			double phi = 2*M_PI*i/n;
+			grid.push_back(Pt3(grow*sin(theta)*cos(phi), grow*sin(theta)*sin(phi), grow*cos(theta)));
+		}
+	}
+	for(int j = 0; j < n/2; j++) {
+		for(int i = 0; i < n; i++) {
+			const Pt3& a = grid[j*n + i];
+			const Pt3& b = grid[j*n + (i+1)%n];
+			const Pt3& c = grid[(j+1)*n + (i+1)%n];
+			const Pt3& d = grid[(j+1)*n + i];
+			addTriangle(tris, mat, a, b, c);
+			addTriangle(tris, mat, a, c, d);
+		}
+	}
+}
+
+void TessellationVisitor::visit(Sphere* sphere, void* ret) {
+	Pt3 c = sphere->getCenter();
+	double r = sphere->getRadius();
+	Mat4 mat;
+	mat.clear();
+	mat[0][0] = mat[1][1] = mat[2][2] = r;
+	mat[3][0] = c[0];
+	mat[3][1] = c[1];
+	mat[3][2] = c[2];
+	mat[3][3] = 1;
+	tessellateSphere((std::vector<Pt3>*) ret, mat);
+}
+
+void TessellationVisitor::visit(Ellipsoid* op, void* ret) {
+	tessellateSphere((std::vector<Pt3>*) ret, op->getForwardMat());
+}
+
+void TessellationVisitor::visit(Box* op, void* ret) {
+	std::vector<Pt3>* tris = (std::vector<Pt3>*) ret;
+	const Mat4& mat = op->getForwardMat();
+	Pt3 v[8];
+	for(int j = 0; j < 8; j++)
+		v[j] = Pt3(j&1 ? 1 : 0, j&2 ? 1 : 0, j&4 ? 1 : 0);
+
+	// Corners of each face, indexed by the bits above
+	const int faces[6][4] = {
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+		{ 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 3, 7, 5 }
+	};
+	for(int f = 0; f < 6; f++) {
+		addTriangle(tris, mat, v[faces[f][0]], v[faces[f][1]], v[faces[f][2]]);
+		addTriangle(tris, mat, v[faces[f][0]], v[faces[f][2]], v[faces[f][3]]);
+	}
+}
+
+void TessellationVisitor::visit(Cylinder* op, void* ret) {
+	std::vector<Pt3>* tris = (std::vector<Pt3>*) ret;
+	const Mat4& mat = op->getForwardMat();
+	const int n = TESSELLATION_SEGMENTS;
+	const double grow = 1/cos(M_PI/n);
+	Pt3 bottom(0, 0, 0), top(0, 0, 1);
+	for(int i = 0; i < n; i++) {
+		double a0 = 2*M_PI*i/n, a1 = 2*M_PI*(i+1)/n;
+		Pt3 b0(grow*cos(a0), grow*sin(a0), 0), b1(grow*cos(a1), grow*sin(a1), 0);
+		Pt3 t0(b0[0], b0[1], 1), t1(b1[0], b1[1], 1);
+		addTriangle(tris, mat, b0, b1, t1);
+		addTriangle(tris, mat, b0, t1, t0);
+		addTriangle(tris, mat, bottom, b0, b1);
+		addTriangle(tris, mat, top, t0, t1);
+	}
+}
+
+void TessellationVisitor::visit(Cone* op, void* ret) {
+	std::vector<Pt3>* tris = (std::vector<Pt3>*) ret;
+	const Mat4& mat = op->getForwardMat();
+	const int n = TESSELLATION_SEGMENTS;
+	const double grow = 1/cos(M_PI/n);
+	Pt3 base(0, 0, 0), apex(0, 0, 1);
+	for(int i = 0; i < n; i++) {
+		double a0 = 2*M_PI*i/n, a1 = 2*M_PI*(i+1)/n;
+		Pt3 b0(grow*cos(a0), grow*sin(a0), 0), b1(grow*cos(a1), grow*sin(a1), 0);
+		addTriangle(tris, mat, b0, b1, apex);
+		addTriangle(tris, mat, base, b0, b1);
+	}
+}
@@ -34,15 +34,24 @@ public:
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
 
+// Light shapes
+#define LIGHT_POINT 0
+#define LIGHT_RECT 1 // parallelogram centered on the position, spanned by two edges
+#define LIGHT_SPHERE 2 // sphere around the position
+
 class Light : public SceneObject {
 protected:
 	unsigned int _id;
 	Pt3 _pos;
 	Color _color;
 	Color _ambient; // Keeping ambient here makes it easier to code than using a global ambient
+	int _shape;
+	Vec3 _edgeU, _edgeV; // LIGHT_RECT only
+	double _radius; // LIGHT_SPHERE only
+	double _range; // distance at which the light fades out, 0 for unlimited reach
 public:
-	inline Light() : _color(Color(1, 1, 1)) {} // Default: white
-	inline Light(const Pt3& pos, const Color& color) : _pos(pos), _color(color) {}
+	inline Light() : _color(Color(1, 1, 1)), _shape(LIGHT_POINT), _radius(0), _range(0) {} // Default: white point light
+	inline Light(const Pt3& pos, const Color& color) : _pos(pos), _color(color), _shape(LIGHT_POINT), _radius(0), _range(0) {}
 
 	inline const Pt3& getPos() const { return _pos; }
 	inline const Color& getColor() const { return _color; }
@@ -54,6 +63,33 @@ public:
 	inline void setAmbient(const Color& c) { _ambient = c; }
 	inline void setId(unsigned int id) { _id = id; }
 
+	inline int getShape() const { return _shape; }
+	inline bool isArea() const { return _shape != LIGHT_POINT; }
+	inline const Vec3& getEdgeU() const { return _edgeU; }
+	inline const Vec3& getEdgeV() const { return _edgeV; }
+	inline double getRadius() const { return _radius; }
+
+	inline void setPoint() { _shape = LIGHT_POINT; }
+	inline void setRect(const Vec3& u, const Vec3& v) { _shape = LIGHT_RECT; _edgeU = u; _edgeV = v; }
+	inline void setSphere(double r) { _shape = LIGHT_SPHERE; _radius = r; }
+
+	inline double getRange() const { return _range; }
+	inline void setRange(double r) { _range = r < 0 ? 0 : r; }
+	// Fraction of the light left at distance d from the position: 1 without a
+	// range, otherwise a smooth window that reaches 0 at the range
+	inline double falloff(double d) const {
+		if(_range <= 0) return 1;
+		double x = d/_range;
+		if(x >= 1) return 0;
+		double w = 1 - x*x*x*x;
+		return w*w;
+	}
+
+	// Radius of the smallest sphere around the position that holds the whole light
+	double getExtent() const;
+	// Point on the light for the sample (u, v) in [0, 1)^2, as seen from the given point
+	Pt3 samplePoint(const Pt3& from, double u, double v) const;
+
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
 
@@ -81,6 +117,7 @@ public:
 	void rotate(double d, int axis);
 	void updateTransform();
 
+	virtual Geometry* clone() const { return new Sphere(*this); }
 	virtual void accept(GeometryVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
@@ -145,6 +182,7 @@ public:
 	void rotate(double d, int axis);
 	void updateTransform();
 
+	virtual Geometry* clone() const { return new Box(*this); }
 	virtual void accept(GeometryVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
@@ -204,6 +242,7 @@ public:
 	void rotate(double d, int axis);
 	void updateTransform();
 
+	virtual Geometry* clone() const { return new Ellipsoid(*this); }
 	virtual void accept(GeometryVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
@@ -263,6 +302,7 @@ public:
 	void rotate(double d, int axis);
 	void updateTransform();
 
+	virtual Geometry* clone() const { return new Cylinder(*this); }
 	virtual void accept(GeometryVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
@@ -322,6 +362,7 @@ public:
 	void rotate(double d, int axis);
 	void updateTransform();
 
+	virtual Geometry* clone() const { return new Cone(*this); }
 	virtual void accept(GeometryVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 	virtual void accept(SceneObjectVisitor* visitor, void* ret) { visitor->visit(this, ret); }
 };
@@ -359,4 +400,33 @@ public:
 	virtual void visit(Operator* op, void* ret);
 };
 
+// Computes the world-space BoundingBox of a shape (ret is a BoundingBox*)
+class BoundsVisitor : public GeometryVisitor {
+public:
+	virtual void visit(Sphere* sphere, void* ret);
+	virtual void visit(Box* op, void* ret);
+	virtual void visit(Ellipsoid* op, void* ret);
+	virtual void visit(Cylinder* op, void* ret);
+	virtual void visit(Cone* op, void* ret);
+	virtual void visit(Operator* op, void* ret) {}
+};
+
+// Segments around the circle of tessellated round shapes
+#define TESSELLATION_SEGMENTS 32
+
+/*
+ * Appends a world-space triangle mesh of a shape to ret (a std::vector<Pt3>*,
+ * three points per triangle). Round shapes are tessellated slightly larger
+ * than the exact surface so that the mesh always contains the shape.
+ */
+class TessellationVisitor : public GeometryVisitor {
+public:
+	virtual void visit(Sphere* sphere, void* ret);
+	virtual void visit(Box* op, void* ret);
+	virtual void visit(Ellipsoid* op, void* ret);
+	virtual void visit(Cylinder* op, void* ret);
+	virtual void visit(Cone* op, void* ret);
+	virtual void visit(Operator* op, void* ret) {}
+};
+
 #endif
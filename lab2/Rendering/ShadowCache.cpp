@@ -0,0 +1,52 @@
+#include "Rendering/ShadowCache.h"
+#include <iostream>
+
+using namespace std;
+
+void ShadowCacheStats::reset() {
+	queries = cacheHits = earlyExits = tests = 0;
+	areaPoints = penumbraPoints = 0;
+}
+
+void ShadowCacheStats::add(const ShadowCacheStats& s) {
+	queries += s.queries;
+	cacheHits += s.cacheHits;
+	earlyExits += s.earlyExits;
+	tests += s.tests;
+	areaPoints += s.areaPoints;
+	penumbraPoints += s.penumbraPoints;
+}
+
+void ShadowCacheStats::print(int light) {
+	double q = queries > 0 ? (double)queries : 1.0;
+	cout << "Light " << light << ": " << queries << " shadow rays, "
+		<< 100*cacheHits/q << "% cache hits, " << 100*earlyExits/q << "% early exits, "
+		<< tests/q << " tests per ray" << endl;
+	if(areaPoints > 0)
+		cout << "Light " << light << ": " << areaPoints << " area light points, "
+			<< 100.0*penumbraPoints/areaPoints << "% in penumbra, "
+			<< (double)queries/areaPoints << " shadow rays per point" << endl;
+}
+
+ShadowCache::ShadowCache(thread::id owner, int numLights) : _owner(owner) {
+	_recent.assign(numLights*RT_SHADOW_CACHE_SIZE, -1);
+	_stats.resize(numLights);
+}
+
+bool ShadowCache::isRecent(int light, int object) const {
+	const int* list = recent(light);
+	for(int k = 0; k < RT_SHADOW_CACHE_SIZE && list[k] >= 0; k++)
+		if(list[k] == object) return true;
+	return false;
+}
+
+void ShadowCache::promote(int light, int object) {
+	int* list = &_recent[light*RT_SHADOW_CACHE_SIZE];
+	int k = 0;
+	while(k < RT_SHADOW_CACHE_SIZE-1 && list[k] != object && list[k] >= 0)
+		k++;
+	// Shift everything before the old slot (or the last one) back by one
+	for(; k > 0; k--)
+		list[k] = list[k-1];
+	list[0] = object;
+}
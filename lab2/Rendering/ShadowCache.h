@@ -0,0 +1,51 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <vector>
+#include <thread>
+
+// Opaque occluders remembered per light, most recent first
+#define RT_SHADOW_CACHE_SIZE 4
+
+// Counters of one light's shadow queries
+struct ShadowCacheStats {
+	long long queries;
+	long long cacheHits; // settled by a remembered occluder
+	long long earlyExits; // settled by an opaque occluder found in the full loop
+	long long tests; // object intersection tests
+	long long areaPoints; // shading points lit by an area light
+	long long penumbraPoints; // of those, points whose first samples disagreed
+
+	ShadowCacheStats() { reset(); }
+	void reset();
+	void add(const ShadowCacheStats& s);
+	void print(int light);
+};
+
+/*
+ * Remembers, per light, the opaque objects that recently blocked a shadow
+ * ray. Neighbouring shading points tend to be shadowed by the same object, so
+ * trying these first usually settles the query with a single test. The list
+ * is kept in move-to-front order, which keeps the most frequent occluders at
+ * the front. One cache belongs to one thread, so no locking is needed.
+ */
+class ShadowCache {
+protected:
+	std::thread::id _owner;
+	std::vector<int> _recent; // RT_SHADOW_CACHE_SIZE entries per light, -1 when unused
+	std::vector<ShadowCacheStats> _stats;
+
+public:
+	ShadowCache(std::thread::id owner, int numLights);
+
+	std::thread::id getOwner() const { return _owner; }
+	int numLights() const { return (int)_stats.size(); }
+
+	const int* recent(int light) const { return &_recent[light*RT_SHADOW_CACHE_SIZE]; }
+	bool isRecent(int light, int object) const;
+	void promote(int light, int object);
+
+	ShadowCacheStats& getStats(int light) { return _stats[light]; }
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "Rendering/Upsampler.h"
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+// Relative depth difference per pixel of distance that still counts as the same surface
+#define RT_UPSAMPLE_DEPTH 0.02
+
+void Upsampler::begin() {
+	_width = _tracer->getWidth();
+	_height = _tracer->getHeight();
+	_stage = 0;
+	_last = 0;
+	_shaded = _fallbacks = 0;
+	// Full resolution frames don't come through here
+	if(_reduction == 1) return;
+	_rays.resize(_width*_height);
+	_hits.assign(_width*_height, HitRecord());
+}
+
+bool Upsampler::draw(int step) {
+	int size = _width*_height;
+	int n = _reduction;
+	int done = 0;
+	while(_stage < 3 && done < step) {
+		if(_last >= size) {
+			_stage++;
+			_last = 0;
+			continue;
+		}
+
+		int k = _last++;
+		int x = k % _width, y = k / _width;
+		bool coarse = (x % n == 0 && y % n == 0);
+		if(_stage == 0) {
+			_rays[k] = _tracer->primaryRay(x, y);
+			_tracer->primaryHit(x, y, _rays[k], _hits[k]);
+		}
+		else if(_stage == 1 && coarse)
+			_tracer->setPixel(x, y, shadePixel(k));
+		else if(_stage == 2 && !coarse)
+			_tracer->setPixel(x, y, upsample(x, y));
+		else
+			continue;
+		done++;
+	}
+	return (_stage >= 3);
+}
+
+Color Upsampler::shadePixel(int k) {
+	_shaded++;
+	Color color(0, 0, 0);
+	if(_hits[k].object >= 0)
+		color = _tracer->shade(_rays[k], _hits[k], 0, 1.0).color;
+	color[3] = 1;
+	return color;
+}
+
+/*
+ * Bilinear weights of the four coarse pixels around (x, y), each scaled by
+ * how close its depth is to the pixel's own and dropped when it shows
+ * another object.
+ */
+Color Upsampler::upsample(int x, int y) {
+	int n = _reduction;
+	int k = x + y*_width;
+	int object = _hits[k].object;
+	double depth = _hits[k].t;
+
+	int x0 = x - x%n, y0 = y - y%n;
+	double fx = (double)(x - x0)/n, fy = (double)(y - y0)/n;
+
+	double sum[3] = {0, 0, 0}, total = 0;
+	for(int j = 0; j < 2; j++) {
+		int cy = y0 + j*n;
+		double wy = j ? fy : 1 - fy;
+		if(cy >= _height || wy == 0) continue;
+		for(int i = 0; i < 2; i++) {
+			int cx = x0 + i*n;
+			double wx = i ? fx : 1 - fx;
+			if(cx >= _width || wx == 0) continue;
+
+			int q = cx + cy*_width;
+			if(_hits[q].object != object) continue;
+			double w = wx*wy;
+			if(object >= 0) {
+				double d = (_hits[q].t - depth) / (depth * RT_UPSAMPLE_DEPTH * n);
+				w *= exp(-d*d);
+			}
+
+			Color c = _tracer->getPixel(cx, cy);
+			sum[0] += w*c[0];
+			sum[1] += w*c[1];
+			sum[2] += w*c[2];
+			total += w;
+		}
+	}
+
+	// No coarse neighbour shows this surface, so it gets its own sample
+	if(total < 1e-3) {
+		_fallbacks++;
+		return shadePixel(k);
+	}
+
+	Color color(sum[0]/total, sum[1]/total, sum[2]/total);
+	color[3] = 1;
+	return color;
+}
+
+void Upsampler::printStats() {
+	if(_reduction == 1) return;
+	long long size = (long long)_width*_height;
+	cout << "Reduced resolution 1/" << _reduction << ": shaded " << _shaded << " of " << size
+		<< " pixels, " << _fallbacks << " fallbacks" << endl;
+}
@@ -0,0 +1,53 @@
+#ifndef UPSAMPLER_H
+#define UPSAMPLER_H
+
+#include "Rendering/Raytracer.h"
+#include <vector>
+
+// Largest supported reduction, shading one pixel of every RT_MAX_REDUCTION^2
+#define RT_MAX_REDUCTION 4
+
+/*
+ * Reduced-resolution rendering for previews. Primary visibility is found
+ * for every pixel, which is cheap next to shading, but only every n-th
+ * pixel of every n-th row is shaded. The others are filled by a joint
+ * bilateral upsampler: the four surrounding shaded pixels are weighted by
+ * distance, depth similarity and whether they show the same object, so
+ * colors don't bleed across silhouettes. A pixel none of whose neighbours
+ * shows its object (a thin object between the shaded pixels) is shaded
+ * itself.
+ *
+ * The image is produced in three stages, each in steps of pixels:
+ * visibility, shading of the coarse grid, upsampling.
+ */
+class Upsampler {
+protected:
+	Raytracer* _tracer;
+	int _reduction; // 1 renders every pixel as usual
+
+	int _width;
+	int _height;
+	int _stage;
+	int _last;
+	std::vector<Ray> _rays;
+	std::vector<HitRecord> _hits;
+	long long _shaded, _fallbacks;
+
+	Color shadePixel(int k);
+	Color upsample(int x, int y);
+
+public:
+	Upsampler(Raytracer* tracer) : _tracer(tracer), _reduction(1),
+		_width(0), _height(0), _stage(0), _last(0), _shaded(0), _fallbacks(0) {}
+
+	void begin();
+	// Processes up to step pixels, returns true when every pixel has a color
+	bool draw(int step);
+
+	void setReduction(int n) { _reduction = n < 1 ? 1 : (n > RT_MAX_REDUCTION ? RT_MAX_REDUCTION : n); }
+	int getReduction() { return _reduction; }
+
+	void printStats();
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "Rendering/Wavefront.h"
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+static double secondsSince(const chrono::steady_clock::time_point& begin) {
+	return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+void WavefrontStats::reset() {
+	generate = intersect = shade = shadow = sort = 0;
+	rays = shadowRays = 0;
+}
+
+void WavefrontStats::print() {
+	cout << "Wavefront stages: generate " << generate << "s, intersect " << intersect
+		<< "s, shade " << shade << "s, shadow " << shadow << "s, sort " << sort << "s" << endl;
+	cout << "Wavefront rays: " << rays << " traced, " << shadowRays << " shadow" << endl;
+}
+
+void WavefrontRenderer::drawTile(int x0, int y0, int w, int h) {
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	_tileX = x0;
+	_tileY = y0;
+	_tileWidth = w;
+	_sorter.setBounds(_tracer->getSceneBounds());
+	_tracer->primaryCandidates(x0, y0, x0+w-1, y0+h-1, _primaryCandidates);
+	_accum.assign(w*h, Color(0, 0, 0));
+	_rays.clear();
+	for(int y = 0; y < h; y++) {
+		for(int x = 0; x < w; x++) {
+			WavefrontRay wr;
+			wr.ray = _tracer->primaryRay(x0+x, y0+y);
+			wr.pixel = x + y*w;
+			wr.weight = 1.0;
+			wr.depth = 0;
+			wr.c = 1.0;
+			_rays.push_back(wr);
+		}
+	}
+	_stats.generate += secondsSince(begin);
+
+	bool primary = true;
+	while(!_rays.empty()) {
+		_stats.rays += _rays.size();
+
+		begin = chrono::steady_clock::now();
+		if(primary)
+			primaryStage(x0, y0, w);
+		else
+			intersectStage();
+		primary = false;
+		_stats.intersect += secondsSince(begin);
+
+		begin = chrono::steady_clock::now();
+		shadeStage();
+		_stats.shade += secondsSince(begin);
+
+		begin = chrono::steady_clock::now();
+		shadowStage();
+		_stats.shadow += secondsSince(begin);
+
+		// Secondary rays become the next wavefront
+		_rays.swap(_reflected);
+		_rays.insert(_rays.end(), _refracted.begin(), _refracted.end());
+
+		if(_sortSecondary && _rays.size() > 1) {
+			begin = chrono::steady_clock::now();
+			_sorter.sort(_rays);
+			_stats.sort += secondsSince(begin);
+		}
+	}
+
+	for(int y = 0; y < h; y++) {
+		for(int x = 0; x < w; x++) {
+			Color color = _accum[x + y*w];
+			color[3] = 1;
+			_tracer->setPixel(x0+x, y0+y, color);
+		}
+	}
+}
+
+// Only the primary wavefront is limited to the objects visible in the tile
+void WavefrontRenderer::primaryStage(int x0, int y0, int w) {
+	_hits.assign(_rays.size(), HitRecord());
+	for(size_t k = 0; k < _rays.size(); k++) {
+		int pixel = _rays[k].pixel;
+		_tracer->setTracingPixel(imagePixel(pixel));
+		_tracer->primaryHit(x0 + pixel%w, y0 + pixel/w, _rays[k].ray, _hits[k], &_primaryCandidates);
+	}
+	_tracer->setTracingPixel(-1);
+}
+
+void WavefrontRenderer::intersectStage() {
+	_hits.assign(_rays.size(), HitRecord());
+	for(size_t k = 0; k < _rays.size(); k++) {
+		_tracer->setTracingPixel(imagePixel(_rays[k].pixel));
+		_tracer->intersect(_rays[k].ray, _hits[k]);
+	}
+	_tracer->setTracingPixel(-1);
+}
+
+void WavefrontRenderer::shadeStage() {
+	_reflected.clear();
+	_refracted.clear();
+	_shadows.clear();
+
+	for(size_t k = 0; k < _rays.size(); k++) {
+		const WavefrontRay& wr = _rays[k];
+		const HitRecord& hit = _hits[k];
+		if(hit.object < 0) continue; // black background
+
+		ShadingPoint sp = _tracer->shadingPoint(wr.ray, hit);
+		Color ambient = _tracer->ambient(sp);
+		Color& accum = _accum[wr.pixel];
+		for(int i = 0; i < 3; i++)
+			accum[i] += wr.weight * ambient[i];
+
+		int numLights = _tracer->lightSamples(sp);
+		for(int s = 0; s < numLights; s++) {
+			double lightWeight;
+			ShadowRequest req;
+			req.sp = sp;
+			req.light = _tracer->sampleLight(sp, s, lightWeight);
+			if(lightWeight == 0) continue;
+			req.pixel = wr.pixel;
+			req.weight = wr.weight * lightWeight;
+			_shadows.push_back(req);
+		}
+
+		// Same depth limit as the recursion: rays deeper than 5 return black
+		if(wr.depth + 1 > 5) continue;
+
+		WavefrontRay next;
+		next.pixel = wr.pixel;
+		next.depth = wr.depth + 1;
+		if(_tracer->reflectedRay(sp, next.ray)) {
+			next.weight = wr.weight * sp.mat->getReflective();
+			next.c = 1.0;
+			_reflected.push_back(next);
+		}
+		if(_tracer->refractedRay(sp, wr.c, next.ray, next.c)) {
+			next.weight = wr.weight * sp.mat->getTransparency();
+			_refracted.push_back(next);
+		}
+	}
+}
+
+void WavefrontRenderer::shadowStage() {
+	_stats.shadowRays += _shadows.size();
+
+	_shadowResults.resize(_shadows.size());
+	for(size_t k = 0; k < _shadows.size(); k++) {
+		_tracer->setTracingPixel(imagePixel(_shadows[k].pixel));
+		_shadowResults[k] = _tracer->directLight(_shadows[k].sp, _shadows[k].light);
+	}
+	_tracer->setTracingPixel(-1);
+
+	// Accumulating separately keeps the loop above free of writes to shared pixels
+	for(size_t k = 0; k < _shadows.size(); k++) {
+		Color& accum = _accum[_shadows[k].pixel];
+		for(int i = 0; i < 3; i++)
+			accum[i] += _shadows[k].weight * _shadowResults[k][i];
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "Rendering/Raytracer.h"
+#include "Rendering/RaySort.h"
+#include <vector>
+
+// Edge length of the tiles whose rays are traced together as one wavefront
+#define RT_WAVEFRONT_TILE 32
+
+// A ray waiting in one of the wavefront queues
+struct WavefrontRay {
+	Ray ray;
+	int pixel; // offset into the tile
+	double weight; // product of the reflectivities/transparencies along the path
+	int depth;
+	double c; // refraction index of the medium the ray travels through
+};
+
+// A shading point waiting for its shadow ray toward one light
+struct ShadowRequest {
+	ShadingPoint sp;
+	int light;
+	int pixel;
+	double weight;
+};
+
+// Time spent in each stage (seconds) and the number of rays that went through them
+struct WavefrontStats {
+	double generate, intersect, shade, shadow, sort;
+	long long rays, shadowRays;
+
+	WavefrontStats() { reset(); }
+	void reset();
+	void print();
+};
+
+/*
+ * Breadth-first alternative to the recursion in Raytracer::trace. All primary
+ * rays of a tile are generated and intersected as one batch, then shaded in a
+ * separate pass that pushes shadow, reflection and refraction rays into their
+ * own queues. The queues are drained stage by stage until no rays are left,
+ * so each stage runs a tight loop over one kind of work.
+ */
+class WavefrontRenderer {
+protected:
+	Raytracer* _tracer;
+	WavefrontStats _stats;
+
+	// Reorders each wavefront of secondary rays before it is intersected
+	RaySorter _sorter;
+	bool _sortSecondary;
+
+	std::vector<WavefrontRay> _rays;
+	std::vector<HitRecord> _hits;
+	std::vector<WavefrontRay> _reflected;
+	std::vector<WavefrontRay> _refracted;
+	std::vector<ShadowRequest> _shadows;
+	std::vector<Color> _shadowResults;
+	std::vector<Color> _accum;
+	ObjectList _primaryCandidates;
+	int _tileX, _tileY, _tileWidth;
+
+	// Image index of a pixel of the current tile, for dependency recording
+	int imagePixel(int pixel) { return _tileX + pixel%_tileWidth + (_tileY + pixel/_tileWidth)*_tracer->getWidth(); }
+
+	// The primary wavefront of the tile at (x0, y0), w pixels wide
+	void primaryStage(int x0, int y0, int w);
+	void intersectStage();
+	void shadeStage();
+	void shadowStage();
+
+public:
+	WavefrontRenderer(Raytracer* tracer) : _tracer(tracer), _sortSecondary(false),
+		_tileX(0), _tileY(0), _tileWidth(1) {}
+
+	void drawTile(int x0, int y0, int w, int h);
+
+	void setSortSecondary(bool b) { _sortSecondary = b; }
+	bool getSortSecondary() { return _sortSecondary; }
+
+	WavefrontStats& getStats() { return _stats; }
+};
+
+#endif
@@ -1,9 +1,15 @@
 #include "GUI/MainWindow.h"
+#include "Rendering/HeadlessRenderer.h"
 #include <FL/Fl.H>
 #include <iostream>
 using namespace std;
 
 int main(int argc, char** argv) {
+	if(HeadlessRenderer::wantsHeadless(argc, argv)) {
+		HeadlessRenderer renderer;
+		return renderer.run(argc, argv);
+	}
+
 	MainWindow m(600, 100, 600, 600, "Raytracer Project");
 	return Fl::run();
 }